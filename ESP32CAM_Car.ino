@@ -77,6 +77,8 @@ extern int gpLed =  4; // Light
 extern String WiFiAddr ="";
 
 void startCameraServer();
+void startUdpControl();
+void startPowerGovernor();
 
 void setup() {
   Serial.begin(115200);
@@ -171,6 +173,8 @@ void setup() {
   Serial.println("WiFi connected");
 
   startCameraServer();
+  startUdpControl();
+  startPowerGovernor();
 
   Serial.print("Camera Ready! Use 'http://");
   Serial.print(WiFi.localIP());
@@ -6,9 +6,14 @@
 #include "esp_http_server.h"
 #include "esp_timer.h"
 #include "esp_camera.h"
+#include "esp_heap_caps.h"
 #include "img_converters.h"
 #include "camera_index.h"
 #include "Arduino.h"
+#include "freertos/event_groups.h"
+#include "lwip/sockets.h"
+#include "car_proto.h"
+#include "frame_hub.h"
 
 extern int gpLb;
 extern int gpLf;
@@ -16,12 +21,31 @@ extern int gpRb;
 extern int gpRf;
 extern int gpLed;
 extern String WiFiAddr;
+extern udp_ctrl_state_t udp_ctrl_state;
+
+int motor_left = 0;     //last values handed to setMotor, -100 ~ +100
+int motor_right = 0;
 
 void WheelAct(int nLf, int nLb, int nRf, int nRb);
 void Drive(int throttle, int steer);
 void setMotor(int left, int right);
 void setOneMotor(int chF, int chB, int val);
 void handle_control_message(char* msg);
+esp_err_t rtp_sdp_handler(httpd_req_t *req);
+void rtp_stop();
+void power_kick();
+int power_stats_json(char * p);
+void trace_init();
+void trace_record(uint8_t source, uint32_t seq, int64_t arrival_us, int throttle, int steer);
+esp_err_t trace_handler(httpd_req_t *req);
+uint32_t trace_entries();
+
+extern uint32_t rtp_frames;
+extern uint32_t rtp_packets;
+extern uint32_t rtp_send_errors;
+extern uint32_t rtp_unsupported;
+extern int power_governor_enable;
+extern int trace_enable;
 
 typedef struct {
         size_t size; //number of values used for filtering
@@ -32,20 +56,117 @@ typedef struct {
 } ra_filter_t;
 
 typedef struct {
-        httpd_req_t *req;
-        size_t len;
-} jpg_chunking_t;
+        bool active;            //exposure is capped manually
+        bool stalled;           //the last cut did not speed capture up, cap is held
+        int aec_value;          //current exposure cap
+        int seed_aec;           //exposure AEC was using when the cap engaged
+        int cuts;               //cuts in effect, 0 = back at the seed
+        int undo_aec_value;     //settings before the last cut, restored as they were
+        int undo_gainceiling;
+        int undo_agc_gain;
+        int gainceiling;        //current gain ceiling, 0 (2x) ~ 6 (128x)
+        int agc_gain;           //manual gain, only used when the user turned AGC off
+        int frames;             //frames since the last decision
+        uint32_t sum_ms;        //frame times of the current window, settled frames only
+        uint32_t step_ms;       //window frame time before the last cut, 0 = nothing to judge
+        int release;            //consecutive windows that allow handing back to AEC
+        int holdoff;            //windows to wait before capping again
+        // sensor settings to restore once the light is good enough again
+        int saved_aec;
+        int saved_aec2;
+        int saved_gainceiling;
+        int saved_agc_gain;
+} exposure_gov_t;
+
+typedef struct {
+        uint32_t ctrl_msgs;         //control frames received over /ws
+        uint32_t ctrl_rtt_last;     //ms, echoed back by the web UI
+        uint32_t ctrl_rtt_avg;
+        uint32_t ctrl_rtt_max;
+        uint32_t ctrl_gap_max;      //ms, longest silence between control frames
+        int64_t ctrl_last_us;
+        uint32_t video_frames;
+        uint64_t video_bytes;
+        uint64_t video_throttle_ms; //time stream sockets spent held back by the cap
+} link_stats_t;
 
 #define PART_BOUNDARY "123456789000000000000987654321"
-static const char* _STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=" PART_BOUNDARY;
+static const char* _STREAM_RESP_HEADER = "HTTP/1.1 200 OK\r\n"
+    "Content-Type: multipart/x-mixed-replace;boundary=" PART_BOUNDARY "\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: close\r\n\r\n";
 static const char* _STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
-static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
+static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %u.%06u\r\n\r\n";
+
+#define STREAM_SNDBUF_SIZE  (16 * 1024)
+#define CAPTURE_TIMEOUT_MS  5000    //sensor wake-up from standby plus a frame
+
+// DSCP code points; the WiFi driver picks the WMM access category from the
+// top three TOS bits, so CS6 lands in AC_VO and CS1 in AC_BK.
+#define DSCP_CS1            8
+#define DSCP_CS6            48
+#define VIDEO_BURST_MS      100     //token bucket depth for the video cap
+#define VIDEO_KBPS_DEFAULT  4000    //about half what an ESP32-CAM sustains over TCP at range
+#define MAX_CTRL_SOCKETS    8
+
+#define HUB_WAITER_BITS     0x00FFFFFF  //one event bit per waiting task, FreeRTOS has 24
+#define HUB_POLL_MS         20          //wait granularity once all bits are taken
+
+#define EXPOSURE_STEP_FRAMES    10      //frames between governor decisions
+#define EXPOSURE_SETTLE_FRAMES  3       //frames after a change that still carry the old exposure
+#define EXPOSURE_AEC_MAX        1200    //OV2640 aec_value range
+#define EXPOSURE_AEC_MIN        20
+#define EXPOSURE_GAIN_MAX       30      //agc_gain range
+#define EXPOSURE_GAIN_STEP      3
+#define EXPOSURE_MIN_SPEEDUP    95      //a cut must bring the frame time under 95% of the last window
+#define EXPOSURE_RELEASE_STEPS  3       //windows in a row before AEC gets control back
+#define EXPOSURE_HOLDOFF_STEPS  30      //windows (~300 frames) to stay off after capping did not help
+
+#define OV2640_REG04        0x104   //sensor bank, AEC[1:0]
+#define OV2640_AEC          0x110   //sensor bank, AEC[9:2]
+#define OV2640_REG45        0x145   //sensor bank, AEC[15:10]
+#define OV2640_GAIN         0x100   //sensor bank, AGC gain, 0 = 1x
 
 static ra_filter_t ra_filter;
 httpd_handle_t stream_httpd = NULL;
 httpd_handle_t camera_httpd = NULL;
+httpd_handle_t preview_httpd = NULL;
 static httpd_handle_t ws_server = NULL;
 
+// Frame hub: one capture task grabs each frame once and publishes every
+// variant somebody is watching; stream handlers only pick up the latest one.
+static SemaphoreHandle_t hub_lock = NULL;
+static EventGroupHandle_t hub_events = NULL;
+static shared_frame_t * hub_frames[STREAM_VARIANTS] = {NULL, NULL};
+static uint32_t hub_seq[STREAM_VARIANTS] = {0, 0};
+static int hub_viewers[STREAM_VARIANTS] = {0, 0};
+static EventBits_t hub_waiters = 0;     //bits handed out to hub_wait_frame_for callers
+
+// Traffic prioritization, all adjustable through /control
+int ctrl_dscp = DSCP_CS6;           //also used by the UDP control socket
+int video_dscp = DSCP_CS1;
+static int video_kbps = VIDEO_KBPS_DEFAULT;    //0 = video not capped
+static int64_t video_tokens = 0;    //bytes, negative while in debt
+static int64_t video_tokens_stamp = 0;
+static portMUX_TYPE video_bucket_mux = portMUX_INITIALIZER_UNLOCKED;
+static int ctrl_socks[MAX_CTRL_SOCKETS];
+int ctrl_sock_count = 0;            //open /ws sessions, read by the power governor
+static portMUX_TYPE ctrl_socks_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static link_stats_t link_stats;
+static ra_filter_t rtt_filter;
+
+uint32_t capture_avg_frame_ms = 0;  //0 while nobody is watching
+
+// Exposure governor: keeps the capture rate at exposure_target_fps in dim
+// light by capping exposure and making up brightness with gain
+static int exposure_target_fps = 15;    //0 turns the governor off
+static exposure_gov_t exposure_gov;
+
+static jpg_scale_t preview_scale = JPG_SCALE_2X;   //160x120 -> 80x60
+static int preview_quality = 40;                    //fmt2jpg quality, higher is better
+
 static ra_filter_t * ra_filter_init(ra_filter_t * filter, size_t sample_size){
     memset(filter, 0, sizeof(ra_filter_t));
 
@@ -74,25 +195,17 @@ static int ra_filter_run(ra_filter_t * filter, int value){
     return filter->sum / filter->count;
 }
 
-static size_t jpg_encode_stream(void * arg, size_t index, const void* data, size_t len){
-    jpg_chunking_t *j = (jpg_chunking_t *)arg;
-    if(!index){
-        j->len = 0;
-    }
-    if(httpd_resp_send_chunk(j->req, (const char *)data, len) != ESP_OK){
-        return 0;
-    }
-    j->len += len;
-    return len;
-}
-
+// Taken from the hub like a stream viewer: subscribing wakes the sensor through
+// the power governor and keeps it awake, and the frame is already JPEG.
 static esp_err_t capture_handler(httpd_req_t *req){
-    camera_fb_t * fb = NULL;
     esp_err_t res = ESP_OK;
     int64_t fr_start = esp_timer_get_time();
+    uint32_t seq = 0;
 
-    fb = esp_camera_fb_get();
-    if (!fb) {
+    hub_subscribe(STREAM_FULL, 1);
+    shared_frame_t * frame = hub_wait_frame_for(STREAM_FULL, &seq, CAPTURE_TIMEOUT_MS);
+    hub_subscribe(STREAM_FULL, -1);
+    if (!frame) {
         Serial.printf("Camera capture failed");
         httpd_resp_send_500(req);
         return ESP_FAIL;
@@ -101,94 +214,572 @@ static esp_err_t capture_handler(httpd_req_t *req){
     httpd_resp_set_type(req, "image/jpeg");
     httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
 
-    size_t fb_len = 0;
-    if(fb->format == PIXFORMAT_JPEG){
-        fb_len = fb->len;
-        res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
-    } else {
-        jpg_chunking_t jchunk = {req, 0};
-        res = frame2jpg_cb(fb, 80, jpg_encode_stream, &jchunk)?ESP_OK:ESP_FAIL;
-        httpd_resp_send_chunk(req, NULL, 0);
-        fb_len = jchunk.len;
-    }
-    esp_camera_fb_return(fb);
+    size_t fb_len = frame->len;
+    res = httpd_resp_send(req, (const char *)frame->buf, frame->len);
+    frame_release(frame);
     int64_t fr_end = esp_timer_get_time();
     Serial.printf("JPG: %uB %ums", (uint32_t)(fb_len), (uint32_t)((fr_end - fr_start)/1000));
     return res;
 }
 
-static esp_err_t stream_handler(httpd_req_t *req){
-    camera_fb_t * fb = NULL;
-    esp_err_t res = ESP_OK;
-    size_t _jpg_buf_len = 0;
-    uint8_t * _jpg_buf = NULL;
-    char * part_buf[64];
+static shared_frame_t * frame_new(uint8_t * buf, size_t len){
+    shared_frame_t * f = (shared_frame_t *)malloc(sizeof(shared_frame_t));
+    if(!f){
+        free(buf);
+        return NULL;
+    }
+    f->refs = 1;
+    f->stamp_us = esp_timer_get_time();
+    f->len = len;
+    f->buf = buf;
+    return f;
+}
 
-    static int64_t last_frame = 0;
-    if(!last_frame) {
-        last_frame = esp_timer_get_time();
+static shared_frame_t * frame_copy(const uint8_t * src, size_t len){
+    uint8_t * buf = (uint8_t *)heap_caps_malloc(len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if(!buf){
+        buf = (uint8_t *)malloc(len);
     }
+    if(!buf){
+        return NULL;
+    }
+    memcpy(buf, src, len);
+    return frame_new(buf, len);
+}
 
-    res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
-    if(res != ESP_OK){
-        return res;
+void frame_release(shared_frame_t * f){
+    if(!f){
+        return;
+    }
+    xSemaphoreTake(hub_lock, portMAX_DELAY);
+    bool last = (--f->refs == 0);
+    xSemaphoreGive(hub_lock);
+    if(last){
+        free(f->buf);
+        free(f);
     }
+}
+
+static void hub_publish(stream_variant_t v, shared_frame_t * f){
+    xSemaphoreTake(hub_lock, portMAX_DELAY);
+    shared_frame_t * old = hub_frames[v];
+    if(!f && !old){
+        xSemaphoreGive(hub_lock);
+        return;
+    }
+    hub_frames[v] = f;
+    hub_seq[v]++;
+    if(f){
+        f->refs++;
+    }
+    xSemaphoreGive(hub_lock);
+    frame_release(old);
+}
 
+int hub_viewer_count(stream_variant_t v){
+    xSemaphoreTake(hub_lock, portMAX_DELAY);
+    int n = hub_viewers[v];
+    xSemaphoreGive(hub_lock);
+    return n;
+}
+
+void hub_subscribe(stream_variant_t v, int delta){
+    xSemaphoreTake(hub_lock, portMAX_DELAY);
+    hub_viewers[v] += delta;
+    xSemaphoreGive(hub_lock);
+    if(delta > 0){
+        power_kick();
+    }
+}
+
+// Blocks until the hub holds a frame newer than *seq, returns it with a reference taken.
+shared_frame_t * hub_wait_frame(stream_variant_t v, uint32_t * seq){
+    return hub_wait_frame_for(v, seq, 0);
+}
+
+// Same as hub_wait_frame, gives up with NULL after timeout_ms (0 waits forever).
+shared_frame_t * hub_wait_frame_for(stream_variant_t v, uint32_t * seq, uint32_t timeout_ms){
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    // A bit of our own, cleared before the first look at hub_seq: a frame
+    // published after that look leaves it set, so no wake-up is lost
+    xSemaphoreTake(hub_lock, portMAX_DELAY);
+    EventBits_t free_bits = ~hub_waiters & HUB_WAITER_BITS;
+    EventBits_t bit = free_bits & (~free_bits + 1);     //lowest free bit, 0 when all are taken
+    hub_waiters |= bit;
+    xSemaphoreGive(hub_lock);
+    if(bit){
+        xEventGroupClearBits(hub_events, bit);
+    }
+
+    shared_frame_t * f = NULL;
     while(true){
-        fb = esp_camera_fb_get();
-        if (!fb) {
-            Serial.printf("Camera capture failed");
-            res = ESP_FAIL;
+        xSemaphoreTake(hub_lock, portMAX_DELAY);
+        if(hub_seq[v] != *seq && hub_frames[v]){
+            f = hub_frames[v];
+            f->refs++;
+            *seq = hub_seq[v];
+        }
+        xSemaphoreGive(hub_lock);
+        if(f){
+            break;
+        }
+        TickType_t ticks = portMAX_DELAY;
+        if(timeout_ms){
+            int64_t left = deadline - esp_timer_get_time();
+            if(left <= 0){
+                break;
+            }
+            ticks = pdMS_TO_TICKS(left / 1000) + 1;
+        }
+        if(bit){
+            xEventGroupWaitBits(hub_events, bit, pdTRUE, pdFALSE, ticks);
         } else {
-            if(fb->format != PIXFORMAT_JPEG){
-                bool jpeg_converted = frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len);
-                esp_camera_fb_return(fb);
-                fb = NULL;
-                if(!jpeg_converted){
-                    Serial.printf("JPEG compression failed");
-                    res = ESP_FAIL;
-                }
+            vTaskDelay(pdMS_TO_TICKS(HUB_POLL_MS));
+        }
+    }
+
+    xSemaphoreTake(hub_lock, portMAX_DELAY);
+    hub_waiters &= ~bit;
+    xSemaphoreGive(hub_lock);
+    return f;
+}
+
+static shared_frame_t * preview_encode(camera_fb_t * fb){
+    // cmd_handler may change these meanwhile, the buffer must match the scale actually decoded
+    jpg_scale_t scale = preview_scale;
+    int quality = preview_quality;
+    int shift = (int)scale;
+    size_t w = fb->width >> shift;
+    size_t h = fb->height >> shift;
+    uint8_t * rgb = (uint8_t *)heap_caps_malloc(w * h * 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if(!rgb){
+        rgb = (uint8_t *)malloc(w * h * 2);
+    }
+    if(!rgb){
+        return NULL;
+    }
+    uint8_t * jpg = NULL;
+    size_t jpg_len = 0;
+    bool ok = jpg2rgb565(fb->buf, fb->len, rgb, scale) &&
+              fmt2jpg(rgb, w * h * 2, w, h, PIXFORMAT_RGB565, quality, &jpg, &jpg_len);
+    free(rgb);
+    if(!ok){
+        return NULL;
+    }
+    return frame_new(jpg, jpg_len);
+}
+
+// The power governor only blames a low frame rate on exposure while the sensor's own AEC runs
+bool exposure_governor_active(){
+    return exposure_gov.active;
+}
+
+static void exposure_release(sensor_t * s){
+    s->set_exposure_ctrl(s, exposure_gov.saved_aec);
+    s->set_aec2(s, exposure_gov.saved_aec2);
+    s->set_gainceiling(s, (gainceiling_t)exposure_gov.saved_gainceiling);
+    s->set_agc_gain(s, exposure_gov.saved_agc_gain);
+    exposure_gov.active = false;
+}
+
+// Exposure the sensor is integrating with right now, AEC's choice while it runs
+static int exposure_sensor_aec(sensor_t * s){
+    if(s->id.PID == OV2640_PID){
+        int lo = s->get_reg(s, OV2640_REG04, 0x03);
+        int mid = s->get_reg(s, OV2640_AEC, 0xFF);
+        int hi = s->get_reg(s, OV2640_REG45, 0x3F);
+        if(lo >= 0 && mid >= 0 && hi >= 0){
+            return (hi << 10) | (mid << 2) | lo;
+        }
+    }
+    return s->status.aec_value;
+}
+
+// True when AGC sits at 1x under the current cap, i.e. AEC alone would not go longer
+static bool exposure_sensor_bright(sensor_t * s){
+    if(s->id.PID != OV2640_PID || !s->status.agc){
+        return false;
+    }
+    int gain = s->get_reg(s, OV2640_GAIN, 0xFF);
+    return gain == 0;
+}
+
+static void exposure_apply(sensor_t * s){
+    if(!s->status.agc){
+        s->set_agc_gain(s, exposure_gov.agc_gain);
+    }
+    s->set_aec_value(s, exposure_gov.aec_value);
+    s->set_gainceiling(s, (gainceiling_t)exposure_gov.gainceiling);
+}
+
+// One step along the exposure/gain trade: shorter exposure with more gain, or back
+static void exposure_step(sensor_t * s, bool shorter){
+    if(shorter){
+        exposure_gov.undo_aec_value = exposure_gov.aec_value;
+        exposure_gov.undo_gainceiling = exposure_gov.gainceiling;
+        exposure_gov.undo_agc_gain = exposure_gov.agc_gain;
+        exposure_gov.cuts++;
+        exposure_gov.aec_value = constrain(exposure_gov.aec_value * 3 / 4, EXPOSURE_AEC_MIN, EXPOSURE_AEC_MAX);
+        exposure_gov.gainceiling = constrain(exposure_gov.gainceiling + 1, 0, (int)GAINCEILING_128X);
+        exposure_gov.agc_gain = constrain(exposure_gov.agc_gain + EXPOSURE_GAIN_STEP, 0, EXPOSURE_GAIN_MAX);
+    } else {
+        if(exposure_gov.cuts){
+            exposure_gov.cuts--;
+        }
+        exposure_gov.aec_value = exposure_gov.cuts ?
+            constrain(exposure_gov.aec_value * 4 / 3, EXPOSURE_AEC_MIN, exposure_gov.seed_aec) : exposure_gov.seed_aec;
+        exposure_gov.gainceiling = constrain(exposure_gov.gainceiling - 1, exposure_gov.saved_gainceiling, (int)GAINCEILING_128X);
+        exposure_gov.agc_gain = constrain(exposure_gov.agc_gain - EXPOSURE_GAIN_STEP, exposure_gov.saved_agc_gain, EXPOSURE_GAIN_MAX);
+    }
+    exposure_apply(s);
+}
+
+// Takes the last cut back exactly; 4/3 of a floored 3/4 would land short of it
+static void exposure_undo(sensor_t * s){
+    exposure_gov.aec_value = exposure_gov.undo_aec_value;
+    exposure_gov.gainceiling = exposure_gov.undo_gainceiling;
+    exposure_gov.agc_gain = exposure_gov.undo_agc_gain;
+    exposure_gov.cuts--;
+    exposure_apply(s);
+}
+
+// Runs once per captured frame with the frame time the streaming loop measured.
+// Decides on the mean of each window, skipping the frames right after a change.
+static void exposure_governor_run(uint32_t frame_ms){
+    sensor_t * s = esp_camera_sensor_get();
+    if(!s){
+        return;
+    }
+    if(!exposure_target_fps){
+        if(exposure_gov.active){
+            exposure_release(s);
+        }
+        return;
+    }
+    if(++exposure_gov.frames > EXPOSURE_SETTLE_FRAMES){
+        exposure_gov.sum_ms += frame_ms;
+    }
+    if(exposure_gov.frames < EXPOSURE_STEP_FRAMES){
+        return;
+    }
+    uint32_t window_ms = exposure_gov.sum_ms / (EXPOSURE_STEP_FRAMES - EXPOSURE_SETTLE_FRAMES);
+    exposure_gov.frames = 0;
+    exposure_gov.sum_ms = 0;
+    if(!window_ms){
+        return;
+    }
+    if(!exposure_gov.active && exposure_gov.holdoff){
+        exposure_gov.holdoff--;
+        return;
+    }
+
+    uint32_t target_ms = 1000 / exposure_target_fps;
+    if(window_ms > target_ms * 11 / 10){
+        // too slow: shorten integration, raise the gain the sensor may use
+        exposure_gov.release = 0;
+        if(!exposure_gov.active){
+            exposure_gov.saved_aec = s->status.aec;
+            exposure_gov.saved_aec2 = s->status.aec2;
+            exposure_gov.saved_gainceiling = s->status.gainceiling;
+            exposure_gov.saved_agc_gain = s->status.agc_gain;
+            // start from what AEC picked so the first cut really is shorter
+            exposure_gov.seed_aec = constrain(exposure_sensor_aec(s), EXPOSURE_AEC_MIN, EXPOSURE_AEC_MAX);
+            exposure_gov.aec_value = exposure_gov.seed_aec;
+            exposure_gov.cuts = 0;
+            exposure_gov.gainceiling = s->status.gainceiling;
+            exposure_gov.agc_gain = s->status.agc_gain;
+            exposure_gov.step_ms = 0;
+            exposure_gov.stalled = false;
+            exposure_gov.active = true;
+            s->set_exposure_ctrl(s, 0);
+            s->set_aec2(s, 0);
+        } else if(exposure_gov.stalled){
+            return;
+        } else if(exposure_gov.step_ms && window_ms * 100 > exposure_gov.step_ms * EXPOSURE_MIN_SPEEDUP){
+            // the last cut bought nothing, capture is CPU or link bound: take it back and hold
+            exposure_undo(s);
+            exposure_gov.step_ms = 0;
+            if(!exposure_gov.cuts){
+                exposure_release(s);
+                exposure_gov.holdoff = EXPOSURE_HOLDOFF_STEPS;
             } else {
-                _jpg_buf_len = fb->len;
-                _jpg_buf = fb->buf;
+                exposure_gov.stalled = true;
             }
+            return;
         }
-        if(res == ESP_OK){
-            size_t hlen = snprintf((char *)part_buf, 64, _STREAM_PART, _jpg_buf_len);
-            res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen);
+        if(exposure_gov.aec_value <= EXPOSURE_AEC_MIN){
+            return;
         }
-        if(res == ESP_OK){
-            res = httpd_resp_send_chunk(req, (const char *)_jpg_buf, _jpg_buf_len);
+        exposure_gov.step_ms = window_ms;
+        exposure_step(s, true);
+    } else if(exposure_gov.active){
+        // AEC would not go longer than the cap once the cap is back at its seed or the
+        // sensor needs no gain at it; require that for a few windows so it doesn't flap
+        if(!exposure_gov.cuts || exposure_sensor_bright(s)){
+            if(++exposure_gov.release >= EXPOSURE_RELEASE_STEPS){
+                exposure_release(s);
+            }
+            return;
         }
-        if(res == ESP_OK){
-            res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+        exposure_gov.release = 0;
+        if(window_ms < target_ms * 8 / 10){
+            // headroom: give exposure back one step
+            exposure_gov.stalled = false;
+            exposure_gov.step_ms = 0;
+            exposure_step(s, false);
         }
-        if(fb){
-            esp_camera_fb_return(fb);
-            fb = NULL;
-            _jpg_buf = NULL;
-        } else if(_jpg_buf){
-            free(_jpg_buf);
-            _jpg_buf = NULL;
+    }
+}
+
+static void capture_task(void * arg){
+    int64_t last_frame = 0;
+
+    while(true){
+        bool want_full = hub_viewer_count(STREAM_FULL) > 0;
+        bool want_preview = hub_viewer_count(STREAM_PREVIEW) > 0;
+        if(!want_full){
+            hub_publish(STREAM_FULL, NULL);   //don't hand a stale frame to the next viewer
         }
-        if(res != ESP_OK){
-            break;
+        if(!want_preview){
+            hub_publish(STREAM_PREVIEW, NULL);
         }
-        int64_t fr_end = esp_timer_get_time();
+        if(!want_full && !want_preview){
+            last_frame = 0;
+            capture_avg_frame_ms = 0;
+            vTaskDelay(pdMS_TO_TICKS(50));
+            continue;
+        }
+        if(!last_frame) {
+            last_frame = esp_timer_get_time();
+        }
+
+        camera_fb_t * fb = esp_camera_fb_get();
+        if (!fb) {
+            Serial.printf("Camera capture failed");
+            vTaskDelay(pdMS_TO_TICKS(10));
+            continue;
+        }
+        int64_t captured = esp_timer_get_time();
+
+        shared_frame_t * full = NULL;
+        shared_frame_t * preview = NULL;
+        if(fb->format != PIXFORMAT_JPEG){
+            uint8_t * _jpg_buf = NULL;
+            size_t _jpg_buf_len = 0;
+            if(frame2jpg(fb, 80, &_jpg_buf, &_jpg_buf_len)){
+                full = frame_new(_jpg_buf, _jpg_buf_len);
+            } else {
+                Serial.printf("JPEG compression failed");
+            }
+            if(full && want_preview){
+                // no cheap scaled decode for raw frames, preview gets the same buffer
+                preview = full;
+                preview->refs++;
+            }
+        } else {
+            if(want_full){
+                full = frame_copy(fb->buf, fb->len);
+            }
+            if(want_preview){
+                preview = preview_encode(fb);
+                if(!preview){
+                    Serial.printf("Preview encode failed");
+                }
+            }
+        }
+        esp_camera_fb_return(fb);
+
+        size_t full_len = full ? full->len : 0;
+        size_t preview_len = preview ? preview->len : 0;
+        if(full){
+            full->stamp_us = captured;
+            hub_publish(STREAM_FULL, full);
+            frame_release(full);
+        }
+        if(preview){
+            preview->stamp_us = captured;
+            hub_publish(STREAM_PREVIEW, preview);
+            frame_release(preview);
+        }
+        xEventGroupSetBits(hub_events, HUB_WAITER_BITS);
 
+        int64_t fr_end = esp_timer_get_time();
         int64_t frame_time = fr_end - last_frame;
         last_frame = fr_end;
         frame_time /= 1000;
         uint32_t avg_frame_time = ra_filter_run(&ra_filter, frame_time);
-        Serial.printf("MJPG: %uB %ums (%.1ffps), AVG: %ums (%.1ffps)"
-            ,(uint32_t)(_jpg_buf_len),
+        capture_avg_frame_ms = avg_frame_time;
+        exposure_governor_run(frame_time);
+        Serial.printf("MJPG: %uB/%uB %ums (%.1ffps), AVG: %ums (%.1ffps)"
+            ,(uint32_t)(full_len), (uint32_t)(preview_len),
             (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time,
             avg_frame_time, 1000.0 / avg_frame_time
         );
     }
+}
 
-    last_frame = 0;
-    return res;
+// Writes the whole iovec to a blocking socket, resuming after partial sends.
+static esp_err_t stream_writev(int fd, struct iovec * iov, int iovcnt){
+    while(iovcnt > 0){
+        ssize_t sent = lwip_writev(fd, iov, iovcnt);
+        if(sent < 0){
+            // EAGAIN is httpd's SO_SNDTIMEO expiring: the viewer stalled, give up on it
+            if(errno == EINTR){
+                continue;
+            }
+            return ESP_FAIL;
+        }
+        while(iovcnt > 0 && (size_t)sent >= iov->iov_len){
+            sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0){
+            iov->iov_base = (uint8_t *)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return ESP_OK;
+}
+
+static void sock_set_dscp(int fd, int dscp){
+    int tos = dscp << 2;
+    setsockopt(fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+}
+
+static void stream_tune_socket(int fd){
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // only honoured when lwIP is built with LWIP_SO_SNDBUF, harmless otherwise
+    int sndbuf = STREAM_SNDBUF_SIZE;
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+}
+
+// Charges len bytes to the token bucket shared by all video sockets and
+// returns how long (us) the caller has to back off to stay under video_kbps.
+int64_t video_bucket_charge(size_t len){
+    int64_t rate = (int64_t)video_kbps * 125;   //bytes per second
+    if(rate <= 0){
+        return 0;
+    }
+    int64_t now = esp_timer_get_time();
+    int64_t debt = 0;
+    portENTER_CRITICAL(&video_bucket_mux);
+    if(video_tokens_stamp){
+        video_tokens += (now - video_tokens_stamp) * rate / 1000000;
+    } else {
+        video_tokens = rate * VIDEO_BURST_MS / 1000;    //first frame starts on a full bucket
+    }
+    video_tokens_stamp = now;
+    if(video_tokens > rate * VIDEO_BURST_MS / 1000){
+        video_tokens = rate * VIDEO_BURST_MS / 1000;
+    }
+    video_tokens -= len;
+    if(video_tokens < 0){
+        debt = -video_tokens;
+    }
+    portEXIT_CRITICAL(&video_bucket_mux);
+    return debt * 1000000 / rate;
+}
+
+static esp_err_t ctrl_sock_open(httpd_handle_t hd, int sockfd){
+    int one = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sock_set_dscp(sockfd, ctrl_dscp);
+    portENTER_CRITICAL(&ctrl_socks_mux);
+    if(ctrl_sock_count < MAX_CTRL_SOCKETS){
+        ctrl_socks[ctrl_sock_count++] = sockfd;
+    }
+    portEXIT_CRITICAL(&ctrl_socks_mux);
+    power_kick();
+    return ESP_OK;
+}
+
+static void ctrl_sock_close(httpd_handle_t hd, int sockfd){
+    portENTER_CRITICAL(&ctrl_socks_mux);
+    for(int i = 0; i < ctrl_sock_count; i++){
+        if(ctrl_socks[i] == sockfd){
+            ctrl_socks[i] = ctrl_socks[--ctrl_sock_count];
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&ctrl_socks_mux);
+    // httpd leaves closing to us once a close_fn is installed
+    close(sockfd);
+}
+
+static void ctrl_socks_set_dscp(int dscp){
+    int socks[MAX_CTRL_SOCKETS];
+    portENTER_CRITICAL(&ctrl_socks_mux);
+    int n = ctrl_sock_count;
+    memcpy(socks, ctrl_socks, n * sizeof(int));
+    portEXIT_CRITICAL(&ctrl_socks_mux);
+    for(int i = 0; i < n; i++){
+        sock_set_dscp(socks[i], dscp);
+    }
+}
+
+// The stream socket is written directly instead of through httpd_resp_send_chunk:
+// no chunked framing, and each part (boundary + part header + JPEG) goes out in
+// one scatter/gather send. The session is closed by httpd once we return.
+static esp_err_t stream_handler(httpd_req_t *req){
+    stream_variant_t variant = (stream_variant_t)(intptr_t)req->user_ctx;
+    shared_frame_t * frame = NULL;
+    uint32_t seq = 0;
+    esp_err_t res = ESP_OK;
+    char part_buf[128];
+    struct iovec iov[3];
+
+    int fd = httpd_req_to_sockfd(req);
+    if(fd < 0){
+        return ESP_FAIL;
+    }
+    stream_tune_socket(fd);
+    int dscp = video_dscp;
+    sock_set_dscp(fd, dscp);
+
+    // every part is followed by a boundary, browsers only show a part once the next boundary arrives
+    iov[0].iov_base = (void *)_STREAM_RESP_HEADER;
+    iov[0].iov_len = strlen(_STREAM_RESP_HEADER);
+    iov[1].iov_base = (void *)_STREAM_BOUNDARY;
+    iov[1].iov_len = strlen(_STREAM_BOUNDARY);
+    res = stream_writev(fd, iov, 2);
+
+    hub_subscribe(variant, 1);
+    while(res == ESP_OK){
+        frame = hub_wait_frame(variant, &seq);
+
+        size_t hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, frame->len,
+            (uint32_t)(frame->stamp_us / 1000000), (uint32_t)(frame->stamp_us % 1000000));
+        iov[0].iov_base = part_buf;
+        iov[0].iov_len = hlen;
+        iov[1].iov_base = frame->buf;
+        iov[1].iov_len = frame->len;
+        iov[2].iov_base = (void *)_STREAM_BOUNDARY;
+        iov[2].iov_len = strlen(_STREAM_BOUNDARY);
+        size_t sent = hlen + frame->len + iov[2].iov_len;
+        res = stream_writev(fd, iov, 3);
+
+        frame_release(frame);
+        frame = NULL;
+
+        link_stats.video_frames++;
+        link_stats.video_bytes += sent;
+        // Sleeping here rather than queueing lets the hub skip frames for us
+        int64_t backoff = video_bucket_charge(sent);
+        if(res == ESP_OK && backoff > 0){
+            vTaskDelay(pdMS_TO_TICKS(backoff / 1000) + 1);
+            link_stats.video_throttle_ms += backoff / 1000;
+        }
+        if(dscp != video_dscp){
+            dscp = video_dscp;
+            sock_set_dscp(fd, dscp);
+        }
+    }
+    hub_subscribe(variant, -1);
+
+    // response was written behind httpd's back, don't let it reuse the session
+    return ESP_FAIL;
 }
 
 static esp_err_t cmd_handler(httpd_req_t *req){
@@ -253,6 +844,42 @@ static esp_err_t cmd_handler(httpd_req_t *req){
     else if(!strcmp(variable, "special_effect")) res = s->set_special_effect(s, val);
     else if(!strcmp(variable, "wb_mode")) res = s->set_wb_mode(s, val);
     else if(!strcmp(variable, "ae_level")) res = s->set_ae_level(s, val);
+    else if(!strcmp(variable, "video_kbps")) {
+        if(val >= 0) video_kbps = val;
+        else res = -1;
+    }
+    else if(!strcmp(variable, "video_dscp")) {
+        if(val >= 0 && val < 64) video_dscp = val;
+        else res = -1;
+    }
+    else if(!strcmp(variable, "ctrl_dscp")) {
+        if(val >= 0 && val < 64) {
+            ctrl_dscp = val;
+            ctrl_socks_set_dscp(val);
+        }
+        else res = -1;
+    }
+    else if(!strcmp(variable, "target_fps")) {
+        if(val >= 0 && val <= 60) {
+            exposure_target_fps = val;
+            exposure_gov.holdoff = 0;   //a new target deserves a fresh try
+        }
+        else res = -1;
+    }
+    else if(!strcmp(variable, "power_gov")) power_governor_enable = val ? 1 : 0;
+    else if(!strcmp(variable, "trace")) trace_enable = val ? 1 : 0;
+    else if(!strcmp(variable, "rtp")) {
+        if(val == 0) rtp_stop();    //started through /rtp.sdp, which knows the receiver
+        else res = -1;
+    }
+    else if(!strcmp(variable, "preview_scale")) {
+        if(val >= JPG_SCALE_2X && val <= JPG_SCALE_8X) preview_scale = (jpg_scale_t)val;
+        else res = -1;
+    }
+    else if(!strcmp(variable, "preview_quality")) {
+        if(val > 0 && val <= 100) preview_quality = val;
+        else res = -1;
+    }
     else {
         res = -1;
     }
@@ -294,7 +921,109 @@ static esp_err_t status_handler(httpd_req_t *req){
     p+=sprintf(p, "\"lenc\":%u,", s->status.lenc);
     p+=sprintf(p, "\"hmirror\":%u,", s->status.hmirror);
     p+=sprintf(p, "\"dcw\":%u,", s->status.dcw);
-    p+=sprintf(p, "\"colorbar\":%u", s->status.colorbar);
+    p+=sprintf(p, "\"colorbar\":%u,", s->status.colorbar);
+    p+=sprintf(p, "\"preview_scale\":%u,", preview_scale);
+    p+=sprintf(p, "\"preview_quality\":%d,", preview_quality);
+    p+=sprintf(p, "\"gov_target_fps\":%d,", exposure_target_fps);
+    p+=sprintf(p, "\"gov_fps\":%u,", capture_avg_frame_ms ? 1000 / capture_avg_frame_ms : 0);
+    p+=sprintf(p, "\"gov_active\":%u,", exposure_gov.active);
+    p+=sprintf(p, "\"gov_stalled\":%u,", exposure_gov.active && exposure_gov.stalled);
+    p+=sprintf(p, "\"gov_aec_value\":%d,", exposure_gov.active ? exposure_gov.aec_value : -1);
+    p+=sprintf(p, "\"gov_gainceiling\":%d,", exposure_gov.active ? exposure_gov.gainceiling : s->status.gainceiling);
+    p+=sprintf(p, "\"gov_agc_gain\":%d", exposure_gov.active ? exposure_gov.agc_gain : s->status.agc_gain);
+    *p++ = '}';
+    *p++ = 0;
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, json_response, strlen(json_response));
+}
+
+// Looks up an integer member of a flat JSON object, e.g. json_int(msg, "c", &v)
+static bool json_int(const char * msg, const char * key, int * val){
+    char pattern[16];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char * p = strstr(msg, pattern);
+    if(!p){
+        return false;
+    }
+    char * end = NULL;
+    long v = strtol(p + strlen(pattern), &end, 10);
+    if(end == p + strlen(pattern)){
+        return false;
+    }
+    *val = (int)v;
+    return true;
+}
+
+// Latency bookkeeping for a control frame: "c" is the sender's clock and is
+// echoed straight back, "r" is the round trip the sender measured last time.
+static void ctrl_track_latency(httpd_req_t *req, const char * msg){
+    int64_t now = esp_timer_get_time();
+    if(link_stats.ctrl_last_us){
+        uint32_t gap = (now - link_stats.ctrl_last_us) / 1000;
+        if(gap > link_stats.ctrl_gap_max){
+            link_stats.ctrl_gap_max = gap;
+        }
+    }
+    link_stats.ctrl_last_us = now;
+    link_stats.ctrl_msgs++;
+
+    int rtt = 0;
+    if(json_int(msg, "r", &rtt) && rtt >= 0){
+        link_stats.ctrl_rtt_last = rtt;
+        link_stats.ctrl_rtt_avg = ra_filter_run(&rtt_filter, rtt);
+        if((uint32_t)rtt > link_stats.ctrl_rtt_max){
+            link_stats.ctrl_rtt_max = rtt;
+        }
+    }
+
+    int stamp = 0;
+    if(json_int(msg, "c", &stamp)){
+        char echo[32];
+        httpd_ws_frame_t pong;
+        memset(&pong, 0, sizeof(pong));
+        pong.type = HTTPD_WS_TYPE_TEXT;
+        pong.payload = (uint8_t *)echo;
+        pong.len = snprintf(echo, sizeof(echo), "{\"c\":%d}", stamp);
+        httpd_ws_send_frame(req, &pong);
+    }
+}
+
+static esp_err_t stats_handler(httpd_req_t *req){
+    static char json_response[1024];
+    char buf[16];
+    char value[8];
+
+    size_t buf_len = httpd_req_get_url_query_len(req) + 1;
+    if(buf_len > 1 && buf_len <= sizeof(buf) &&
+       httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK &&
+       httpd_query_key_value(buf, "reset", value, sizeof(value)) == ESP_OK){
+        memset(&link_stats, 0, sizeof(link_stats));
+    }
+
+    char * p = json_response;
+    *p++ = '{';
+    p+=power_stats_json(p);
+    p+=sprintf(p, "\"ctrl_clients\":%d,", ctrl_sock_count);
+    p+=sprintf(p, "\"ctrl_msgs\":%u,", link_stats.ctrl_msgs);
+    p+=sprintf(p, "\"ctrl_rtt_last\":%u,", link_stats.ctrl_rtt_last);
+    p+=sprintf(p, "\"ctrl_rtt_avg\":%u,", link_stats.ctrl_rtt_avg);
+    p+=sprintf(p, "\"ctrl_rtt_max\":%u,", link_stats.ctrl_rtt_max);
+    p+=sprintf(p, "\"ctrl_gap_max\":%u,", link_stats.ctrl_gap_max);
+    p+=sprintf(p, "\"ctrl_dscp\":%d,", ctrl_dscp);
+    p+=sprintf(p, "\"udp_active\":%u,", udp_ctrl_state.active);
+    p+=sprintf(p, "\"udp_accepted\":%u,", udp_ctrl_state.accepted);
+    p+=sprintf(p, "\"udp_discarded\":%u,", udp_ctrl_state.discarded);
+    p+=sprintf(p, "\"video_frames\":%u,", link_stats.video_frames);
+    p+=sprintf(p, "\"video_bytes\":%llu,", (unsigned long long)link_stats.video_bytes);
+    p+=sprintf(p, "\"video_throttle_ms\":%llu,", (unsigned long long)link_stats.video_throttle_ms);
+    p+=sprintf(p, "\"video_kbps\":%d,", video_kbps);
+    p+=sprintf(p, "\"video_dscp\":%d,", video_dscp);
+    p+=sprintf(p, "\"trace_entries\":%u,", trace_entries());
+    p+=sprintf(p, "\"rtp_frames\":%u,", rtp_frames);
+    p+=sprintf(p, "\"rtp_packets\":%u,", rtp_packets);
+    p+=sprintf(p, "\"rtp_send_errors\":%u,", rtp_send_errors);
+    p+=sprintf(p, "\"rtp_unsupported\":%u", rtp_unsupported);
     *p++ = '}';
     *p++ = 0;
     httpd_resp_set_type(req, "application/json");
@@ -332,6 +1061,7 @@ static esp_err_t ws_handler(httpd_req_t *req)
 
         // Handle control message
         handle_control_message((char*)ws_pkt.payload);
+        ctrl_track_latency(req, (char*)ws_pkt.payload);
 
         free(ws_pkt.payload);
     }
@@ -358,14 +1088,16 @@ static esp_err_t index_handler(httpd_req_t *req){
     page += "<button id=\"stopBtn\">Stop</button>";
     page += "<button id=\"accelBtn\">Accelerate</button>";
     page += "<button id=\"decelBtn\">Decelerate</button>";
+    page += "<button id=\"previewBtn\">Low-res</button>";
     page += "</div>";
     page += "<script>";
     page += "if (window.innerHeight > window.innerWidth) {";
     page += "  document.body.innerHTML = '<div style=\"display:flex; align-items:center; justify-content:center; height:100vh; font-size:24px;\">请横屏使用此应用</div>';";
     page += "} else {";
     page += "var ws = new WebSocket('ws://' + window.location.hostname + ':82/ws');";
-    page += "var throttle = 0, steer = 0, speedMultiplier = 1;";
-    page += "function sendControl() { if (ws.readyState === WebSocket.OPEN) { ws.send(JSON.stringify({t: Math.round(throttle * speedMultiplier), s: Math.round(steer * speedMultiplier)})); } }";
+    page += "var throttle = 0, steer = 0, speedMultiplier = 1, lastRtt = -1;";
+    page += "ws.onmessage = function(e) { var m = JSON.parse(e.data); if (m.c !== undefined) lastRtt = Math.round(performance.now()) - m.c; };";
+    page += "function sendControl() { if (ws.readyState === WebSocket.OPEN) { var m = {t: Math.round(throttle * speedMultiplier), s: Math.round(steer * speedMultiplier), c: Math.round(performance.now())}; if (lastRtt >= 0) { m.r = lastRtt; lastRtt = -1; } ws.send(JSON.stringify(m)); } }";
     page += "setInterval(sendControl, 50);";
     page += "var canvas = document.getElementById('joystick'), ctx = canvas.getContext('2d');";
     page += "var centerX = canvas.width / 2, centerY = canvas.height / 2, radius = 80, stickRadius = 15, stickX = centerX, stickY = centerY;";
@@ -381,6 +1113,8 @@ static esp_err_t index_handler(httpd_req_t *req){
     page += "document.getElementById('stopBtn').onclick = () => { fetch('/stop'); throttle = 0; steer = 0; stickX = centerX; stickY = centerY; draw(); };";
     page += "document.getElementById('accelBtn').onclick = () => { speedMultiplier = Math.min(speedMultiplier + 0.5, 3); };";
     page += "document.getElementById('decelBtn').onclick = () => { speedMultiplier = Math.max(speedMultiplier - 0.5, 0.2); };";
+    page += "var lowRes = false;";
+    page += "document.getElementById('previewBtn').onclick = function() { lowRes = !lowRes; document.getElementById('stream').src = 'http://' + window.location.hostname + (lowRes ? ':83/preview' : ':81/stream'); this.textContent = lowRes ? 'Full-res' : 'Low-res'; };";
     page += "var fullscreenBtn = document.getElementById('fullscreenBtn');";
     page += "function toggleFullscreen() {";
     page += "    if (!document.fullscreenElement && !document.webkitFullscreenElement && !document.msFullscreenElement) {";
@@ -411,8 +1145,15 @@ static esp_err_t index_handler(httpd_req_t *req){
 }
 
 
+// Button endpoints drive the motors directly, the trace gets the equivalent throttle/steer
+static void trace_http(int throttle, int steer){
+    static uint32_t http_seq = 0;
+    trace_record(TRACE_SRC_HTTP, ++http_seq, esp_timer_get_time(), throttle, steer);
+}
+
 static esp_err_t go_handler(httpd_req_t *req){
     setMotor(100, 100);
+    trace_http(100, 0);
     Serial.println("Go");
     httpd_resp_set_type(req, "text/html");
     return httpd_resp_send(req, "OK", 2);
@@ -420,6 +1161,7 @@ static esp_err_t go_handler(httpd_req_t *req){
 
 static esp_err_t back_handler(httpd_req_t *req){
     setMotor(-100, -100);
+    trace_http(-100, 0);
     Serial.println("Back");
     httpd_resp_set_type(req, "text/html");
     return httpd_resp_send(req, "OK", 2);
@@ -427,6 +1169,7 @@ static esp_err_t back_handler(httpd_req_t *req){
 
 static esp_err_t left_handler(httpd_req_t *req){
     setMotor(-100, 100);
+    trace_http(0, -100);
     Serial.println("Left");
     httpd_resp_set_type(req, "text/html");
     return httpd_resp_send(req, "OK", 2);
@@ -434,6 +1177,7 @@ static esp_err_t left_handler(httpd_req_t *req){
 
 static esp_err_t right_handler(httpd_req_t *req){
     setMotor(100, -100);
+    trace_http(0, 100);
     Serial.println("Right");
     httpd_resp_set_type(req, "text/html");
     return httpd_resp_send(req, "OK", 2);
@@ -441,6 +1185,7 @@ static esp_err_t right_handler(httpd_req_t *req){
 
 static esp_err_t stop_handler(httpd_req_t *req){
     setMotor(0, 0);
+    trace_http(0, 0);
     Serial.println("Stop");
     httpd_resp_set_type(req, "text/html");
     return httpd_resp_send(req, "OK", 2);
@@ -457,6 +1202,7 @@ static esp_err_t toggleled_handler(httpd_req_t *req){
 
 void startCameraServer(){
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.max_uri_handlers = 16;
 
     httpd_uri_t go_uri = {
         .uri       = "/go",
@@ -514,6 +1260,27 @@ void startCameraServer(){
         .user_ctx  = NULL
     };
 
+    httpd_uri_t stats_uri = {
+        .uri       = "/stats",
+        .method    = HTTP_GET,
+        .handler   = stats_handler,
+        .user_ctx  = NULL
+    };
+
+    httpd_uri_t rtp_sdp_uri = {
+        .uri       = "/rtp.sdp",
+        .method    = HTTP_GET,
+        .handler   = rtp_sdp_handler,
+        .user_ctx  = NULL
+    };
+
+    httpd_uri_t trace_uri = {
+        .uri       = "/trace",
+        .method    = HTTP_GET,
+        .handler   = trace_handler,
+        .user_ctx  = NULL
+    };
+
     httpd_uri_t cmd_uri = {
         .uri       = "/control",
         .method    = HTTP_GET,
@@ -532,7 +1299,14 @@ void startCameraServer(){
         .uri       = "/stream",
         .method    = HTTP_GET,
         .handler   = stream_handler,
-        .user_ctx  = NULL
+        .user_ctx  = (void *)STREAM_FULL
+    };
+
+    httpd_uri_t preview_uri = {
+        .uri       = "/preview",
+        .method    = HTTP_GET,
+        .handler   = stream_handler,
+        .user_ctx  = (void *)STREAM_PREVIEW
     };
 
     httpd_uri_t ws_uri = {
@@ -544,6 +1318,12 @@ void startCameraServer(){
     };
 
     ra_filter_init(&ra_filter, 20);
+    ra_filter_init(&rtt_filter, 20);
+    trace_init();
+    hub_lock = xSemaphoreCreateMutex();
+    hub_events = xEventGroupCreate();
+    xTaskCreatePinnedToCore(capture_task, "capture", 8192, NULL, 5, NULL, 1);
+
     Serial.printf("Starting web server on port: '%d'", config.server_port);
     if (httpd_start(&camera_httpd, &config) == ESP_OK) {
         httpd_register_uri_handler(camera_httpd, &index_uri);
@@ -553,6 +1333,12 @@ void startCameraServer(){
         httpd_register_uri_handler(camera_httpd, &left_uri);
         httpd_register_uri_handler(camera_httpd, &right_uri);
         httpd_register_uri_handler(camera_httpd, &toggleled_uri);
+        httpd_register_uri_handler(camera_httpd, &status_uri);
+        httpd_register_uri_handler(camera_httpd, &cmd_uri);
+        httpd_register_uri_handler(camera_httpd, &stats_uri);
+        httpd_register_uri_handler(camera_httpd, &rtp_sdp_uri);
+        httpd_register_uri_handler(camera_httpd, &trace_uri);
+        httpd_register_uri_handler(camera_httpd, &capture_uri);
     }
 
     config.server_port += 1;
@@ -564,10 +1350,22 @@ void startCameraServer(){
 
     config.server_port += 1;
     config.ctrl_port += 1;
+    config.open_fn = ctrl_sock_open;
+    config.close_fn = ctrl_sock_close;
     Serial.printf("Starting WebSocket server on port: '%d'", config.server_port);
     if (httpd_start(&ws_server, &config) == ESP_OK) {
         httpd_register_uri_handler(ws_server, &ws_uri);
     }
+    config.open_fn = NULL;
+    config.close_fn = NULL;
+
+    // Low-res preview gets its own server so it can run beside a full-size viewer
+    config.server_port += 1;
+    config.ctrl_port += 1;
+    Serial.printf("Starting preview stream server on port: '%d'", config.server_port);
+    if (httpd_start(&preview_httpd, &config) == ESP_OK) {
+        httpd_register_uri_handler(preview_httpd, &preview_uri);
+    }
 }
 
 void WheelAct(int nLf, int nLb, int nRf, int nRb)
@@ -582,16 +1380,15 @@ void Drive(int throttle, int steer) {
     // throttle: -100 ~ +100
     // steer:    -100 ~ +100
 
-    int left  = throttle + steer;
-    int right = throttle - steer;
-
-    left  = constrain(left,  -100, 100);
-    right = constrain(right, -100, 100);
+    int left, right;
+    drive_mix(throttle, steer, &left, &right);
 
     setMotor(left, right);
 }
 
 void setMotor(int left, int right) {
+    motor_left = left;
+    motor_right = right;
     setOneMotor(0, 1, left);   // Left
     setOneMotor(2, 3, right);  // Right
 }
@@ -612,7 +1409,10 @@ void setOneMotor(int chF, int chB, int val) {
 }
 
 void handle_control_message(char* msg) {
+    static uint32_t ws_seq = 0;
+    int64_t arrival = esp_timer_get_time();
     int t = 0, s = 0;
     sscanf(msg, "{\"t\":%d,\"s\":%d}", &t, &s);
     Drive(t, s);
+    trace_record(TRACE_SRC_WS, ++ws_seq, arrival, t, s);
 }
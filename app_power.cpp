@@ -0,0 +1,185 @@
+/*
+ * @Date: 2026-10-19 10:00:00
+ * @Description: ESP32 Camera Surveillance Car
+ *               Power governor: CPU clock, WiFi modem sleep and camera standby
+ *               follow the number of connected clients and the frame rate
+ * @FilePath:
+ */
+#include "esp_timer.h"
+#include "esp_camera.h"
+#include "esp_wifi.h"
+#include "Arduino.h"
+#include "car_proto.h"
+#include "frame_hub.h"
+
+#define POWER_TICK_MS       250
+#define POWER_HOLD_MS       5000    //how long a lower state must be wanted before stepping down
+#define POWER_LOW_FPS       8       //below this the sensor, not the CPU, may limit the stream
+#define POWER_HIGH_FPS      10
+#define POWER_SETTLE_MS     3000    //the frame time average needs this long to follow a clock change
+#define POWER_LOW_SLOWER    115     //stream_low costing more than 15% of the frame rate means CPU bound
+#define POWER_LOW_RETRY_MS  30000   //how long stream_low stays off after it cost frames
+
+#define OV2640_COM2         0x109   //sensor bank (0x100) register 0x09
+#define OV2640_COM2_STANDBY 0x10
+
+typedef enum {
+        POWER_IDLE = 0,     //nobody connected
+        POWER_CONTROL,      //driving without video
+        POWER_STREAM_LOW,   //video limited by exposure, CPU mostly waits for the sensor
+        POWER_STREAM,       //video at full rate
+        POWER_STATES
+} power_state_t;
+
+typedef struct {
+        const char * name;
+        uint32_t cpu_mhz;
+        wifi_ps_type_t wifi_ps;
+        bool camera;
+} power_profile_t;
+
+static const power_profile_t power_profiles[POWER_STATES] = {
+    {"idle",       80,  WIFI_PS_MAX_MODEM, false},
+    {"control",    160, WIFI_PS_NONE,      false},
+    {"stream_low", 160, WIFI_PS_NONE,      true},
+    {"stream",     240, WIFI_PS_NONE,      true},
+};
+
+extern int ctrl_sock_count;
+extern udp_ctrl_state_t udp_ctrl_state;
+extern uint32_t capture_avg_frame_ms;
+bool exposure_governor_active();
+
+int power_governor_enable = 1;  //0 pins the car to POWER_STREAM, for A/B comparisons
+
+static power_state_t power_state = POWER_STREAM;
+static uint64_t power_time_ms[POWER_STATES];
+static uint32_t power_transitions = 0;
+static int64_t power_state_since = 0;
+static TaskHandle_t power_task_handle = NULL;
+static uint32_t power_low_entry_ms = 0;     //average frame time at 240 MHz when stepping down to stream_low
+static int64_t power_low_blocked_until = 0;
+
+// Called when a client connects so the car powers up without waiting for the next tick
+void power_kick(){
+    if(power_task_handle){
+        xTaskNotifyGive(power_task_handle);
+    }
+}
+
+static void camera_standby(bool standby){
+    sensor_t * s = esp_camera_sensor_get();
+    if(s && s->id.PID == OV2640_PID){
+        s->set_reg(s, OV2640_COM2, OV2640_COM2_STANDBY, standby ? OV2640_COM2_STANDBY : 0);
+    }
+}
+
+static void power_apply(power_state_t from, power_state_t to){
+    const power_profile_t * p = &power_profiles[to];
+    // wake the sensor before the capture task asks for a frame, put it to sleep last
+    if(p->camera && !power_profiles[from].camera){
+        camera_standby(false);
+    }
+    setCpuFrequencyMhz(p->cpu_mhz);
+    esp_wifi_set_ps(p->wifi_ps);
+    if(!p->camera && power_profiles[from].camera){
+        camera_standby(true);
+    }
+}
+
+static power_state_t power_wanted(power_state_t current, int64_t now){
+    if(!power_governor_enable){
+        return POWER_STREAM;
+    }
+    int viewers = 0;
+    for(int v = 0; v < STREAM_VARIANTS; v++){
+        viewers += hub_viewer_count((stream_variant_t)v);
+    }
+    if(viewers > 0){
+        uint32_t ms = capture_avg_frame_ms;
+        if(!ms){
+            return POWER_STREAM;        //no measurement yet
+        }
+        uint32_t fps = 1000 / ms;
+        bool settled = now - power_state_since >= (int64_t)POWER_SETTLE_MS * 1000;
+        if(current == POWER_STREAM_LOW){
+            if(settled && ms > power_low_entry_ms * POWER_LOW_SLOWER / 100){
+                // the slower clock cost frames, so the CPU was the limit after all
+                power_low_blocked_until = now + (int64_t)POWER_LOW_RETRY_MS * 1000;
+                return POWER_STREAM;
+            }
+            return fps > POWER_HIGH_FPS ? POWER_STREAM : POWER_STREAM_LOW;
+        }
+        // step down only on a rate measured at full clock while AEC, not the
+        // exposure governor, sets the exposure: then the sensor is the limit
+        if(current == POWER_STREAM && settled && fps < POWER_LOW_FPS &&
+           !exposure_governor_active() && now >= power_low_blocked_until){
+            power_low_entry_ms = ms;
+            return POWER_STREAM_LOW;
+        }
+        return POWER_STREAM;
+    }
+    if(ctrl_sock_count > 0 || udp_ctrl_state.active){
+        return POWER_CONTROL;
+    }
+    return POWER_IDLE;
+}
+
+static void power_task(void * arg){
+    int64_t lower_since = 0;
+
+    while(true){
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(POWER_TICK_MS));
+        int64_t now = esp_timer_get_time();
+        power_state_t wanted = power_wanted(power_state, now);
+
+        // step up at once, step down only after the lower state held for a while
+        bool change = false;
+        if(wanted > power_state){
+            change = true;
+        } else if(wanted < power_state){
+            if(!lower_since){
+                lower_since = now;
+            }
+            change = now - lower_since >= (int64_t)POWER_HOLD_MS * 1000;
+        }
+        if(wanted >= power_state){
+            lower_since = 0;
+        }
+        if(!change){
+            continue;
+        }
+
+        power_time_ms[power_state] += (now - power_state_since) / 1000;
+        power_state_since = now;
+        power_apply(power_state, wanted);
+        Serial.printf("Power: %s -> %s", power_profiles[power_state].name, power_profiles[wanted].name);
+        power_state = wanted;
+        power_transitions++;
+        lower_since = 0;
+    }
+}
+
+// Appends the governor's fields to the /stats JSON object, returns bytes written
+int power_stats_json(char * p){
+    char * start = p;
+    int64_t now = esp_timer_get_time();
+    p+=sprintf(p, "\"power_state\":\"%s\",", power_profiles[power_state].name);
+    p+=sprintf(p, "\"power_governor\":%d,", power_governor_enable);
+    p+=sprintf(p, "\"power_transitions\":%u,", power_transitions);
+    p+=sprintf(p, "\"cpu_mhz\":%u,", getCpuFrequencyMhz());
+    for(int i = 0; i < POWER_STATES; i++){
+        uint64_t ms = power_time_ms[i];
+        if(i == power_state){
+            ms += (now - power_state_since) / 1000;
+        }
+        p+=sprintf(p, "\"power_ms_%s\":%llu,", power_profiles[i].name, (unsigned long long)ms);
+    }
+    return p - start;
+}
+
+void startPowerGovernor(){
+    // boot runs at the full profile, the first tick steps down once nobody connects
+    power_state_since = esp_timer_get_time();
+    xTaskCreate(power_task, "power", 3072, NULL, 4, &power_task_handle);
+}
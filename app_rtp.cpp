@@ -0,0 +1,238 @@
+/*
+ * @Date: 2026-10-19 10:00:00
+ * @Description: ESP32 Camera Surveillance Car
+ *               RTP/JPEG (RFC 2435) sender over UDP, announced through /rtp.sdp
+ * @FilePath:
+ */
+#include "esp_http_server.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "lwip/sockets.h"
+#include "Arduino.h"
+#include "car_proto.h"
+#include "frame_hub.h"
+
+uint32_t rtp_frames = 0;    //frames fully handed to the socket
+uint32_t rtp_packets = 0;
+uint32_t rtp_send_errors = 0;
+uint32_t rtp_unsupported = 0; //frames the packetizer could not split (not baseline JPEG)
+
+static int rtp_sock = -1;            //owned by rtp_task
+static int rtcp_sock = -1;
+static volatile int rtp_port = 0;   //receiver's RTP port, the car binds the same pair
+static struct sockaddr_in rtp_dest;
+static volatile bool rtp_running = false;
+static volatile int64_t rtp_lease_end = 0;   //no RR or /rtp.sdp by then: receiver is gone
+static TaskHandle_t rtp_task_handle = NULL;
+
+static void rtp_renew(){
+    rtp_lease_end = esp_timer_get_time() + (int64_t)RTP_LEASE_MS * 1000;
+}
+
+// Receiver reports from the current receiver extend the lease
+static void rtp_poll_rtcp(){
+    uint8_t buf[64];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    int len;
+    while((len = recvfrom(rtcp_sock, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len)) >= 0){
+        if(rtcp_is_rr(buf, len) && from.sin_addr.s_addr == rtp_dest.sin_addr.s_addr){
+            rtp_renew();
+        }
+        from_len = sizeof(from);
+    }
+}
+
+// Sends from and listens on the receiver's own port pair: players that read
+// c= send their RTCP to the car on the RTP port + 1, others to the source port + 1
+static bool rtp_bind(int port){
+    if(rtp_sock >= 0) close(rtp_sock);
+    if(rtcp_sock >= 0) close(rtcp_sock);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    rtp_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    rtcp_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    addr.sin_port = htons(port);
+    bool ok = rtp_sock >= 0 && bind(rtp_sock, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    addr.sin_port = htons(port + 1);
+    ok = ok && rtcp_sock >= 0 && bind(rtcp_sock, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    if(!ok){
+        if(rtp_sock >= 0) close(rtp_sock);
+        if(rtcp_sock >= 0) close(rtcp_sock);
+        rtp_sock = rtcp_sock = -1;
+    }
+    return ok;
+}
+
+static bool rtp_send(const uint8_t * pkt, size_t len){
+    for(int tries = 0; tries < 3; tries++){
+        if(sendto(rtp_sock, pkt, len, 0, (struct sockaddr *)&rtp_dest, sizeof(rtp_dest)) >= 0){
+            return true;
+        }
+        // lwIP ran out of pbufs, let the WiFi task drain the queue
+        vTaskDelay(1);
+    }
+    return false;
+}
+
+// Frames are taken from the hub latest-first like the MJPEG viewers, so a
+// slow link drops whole frames instead of building up a queue.
+static void rtp_task(void * arg){
+    static uint8_t pkt[RTP_JPEG_MTU];
+    uint16_t seq = esp_random();
+    uint32_t ssrc = esp_random();
+    uint32_t frame_seq = 0;
+    int dscp = -1;
+    int bound_port = 0;
+
+    while(true){
+        if(!rtp_running){
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+        hub_subscribe(STREAM_FULL, 1);
+        while(rtp_running){
+            if(bound_port != rtp_port){
+                bound_port = rtp_port;
+                dscp = -1;
+                if(!rtp_bind(bound_port)){
+                    Serial.printf("RTP ports %d/%d busy", bound_port, bound_port + 1);
+                    bound_port = 0;
+                    rtp_running = false;
+                    break;
+                }
+            }
+            rtp_poll_rtcp();
+            if(esp_timer_get_time() > rtp_lease_end){
+                // player quit without telling us, don't keep the camera and radio busy
+                Serial.printf("RTP lease expired");
+                rtp_running = false;
+                break;
+            }
+            if(dscp != video_dscp){
+                dscp = video_dscp;
+                int tos = dscp << 2;
+                setsockopt(rtp_sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+            }
+
+            shared_frame_t * frame = hub_wait_frame(STREAM_FULL, &frame_seq);
+            rtp_jpeg_t jpeg;
+            size_t sent = 0;
+            if(rtp_jpeg_parse(frame->buf, frame->len, &jpeg)){
+                uint32_t ts = (uint32_t)(frame->stamp_us * (RTP_JPEG_CLOCK / 1000) / 1000);
+                size_t offset = 0, len;
+                while((len = rtp_jpeg_packet(&jpeg, &offset, seq, ts, ssrc, pkt, sizeof(pkt))) > 0){
+                    seq++;
+                    if(!rtp_send(pkt, len)){
+                        rtp_send_errors++;
+                        break;      //rest of the frame is useless to the receiver
+                    }
+                    rtp_packets++;
+                    sent += len;
+                }
+                if(offset == jpeg.scan_len){
+                    rtp_frames++;
+                }
+            } else {
+                rtp_unsupported++;
+            }
+            frame_release(frame);
+
+            int64_t backoff = video_bucket_charge(sent);
+            if(backoff > 0){
+                vTaskDelay(pdMS_TO_TICKS(backoff / 1000) + 1);
+            }
+        }
+        hub_subscribe(STREAM_FULL, -1);
+    }
+}
+
+// IPv4 address of a socket end, httpd sockets may be IPv6 with mapped v4 addresses
+static bool sock_ipv4(int fd, bool peer, struct in_addr * out){
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    int res = peer ? getpeername(fd, (struct sockaddr *)&addr, &len) : getsockname(fd, (struct sockaddr *)&addr, &len);
+    if(res < 0){
+        return false;
+    }
+    if(addr.ss_family == AF_INET){
+        *out = ((struct sockaddr_in *)&addr)->sin_addr;
+        return true;
+    }
+    if(addr.ss_family == AF_INET6){
+        memcpy(&out->s_addr, ((struct sockaddr_in6 *)&addr)->sin6_addr.s6_addr + 12, 4);
+        return true;
+    }
+    return false;
+}
+
+void rtp_stop(){
+    rtp_running = false;
+}
+
+// GET /rtp.sdp?port=5004 starts sending RTP to the requesting host on that
+// port and answers with the SDP a player needs to receive it. There is one
+// receiver at a time; repeating the request or sending RTCP RRs keeps it.
+esp_err_t rtp_sdp_handler(httpd_req_t *req){
+    char buf[32];
+    char value[8];
+    int port = RTP_JPEG_DEFAULT_PORT;
+
+    size_t buf_len = httpd_req_get_url_query_len(req) + 1;
+    if(buf_len > 1 && buf_len <= sizeof(buf) &&
+       httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK &&
+       httpd_query_key_value(buf, "port", value, sizeof(value)) == ESP_OK){
+        port = atoi(value);
+    }
+    if(port <= 0 || port > 65534){    //RTCP goes to port + 1
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+
+    int fd = httpd_req_to_sockfd(req);
+    struct in_addr peer, local;
+    if(!sock_ipv4(fd, true, &peer) || !sock_ipv4(fd, false, &local)){
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    if(rtp_running && (rtp_dest.sin_addr.s_addr != peer.s_addr || rtp_dest.sin_port != htons(port))){
+        Serial.printf("RTP receiver replaced");
+    }
+    memset(&rtp_dest, 0, sizeof(rtp_dest));
+    rtp_dest.sin_family = AF_INET;
+    rtp_dest.sin_port = htons(port);
+    rtp_dest.sin_addr = peer;
+    rtp_port = port;
+    rtp_renew();
+    rtp_running = true;
+    if(!rtp_task_handle){
+        xTaskCreatePinnedToCore(rtp_task, "rtp", 4096, NULL, 5, &rtp_task_handle, 1);
+    }
+
+    // c= is the car itself: players send their RTCP receiver reports to it on
+    // the m= port + 1, which is what keeps the lease alive
+    char local_ip[16], peer_ip[16];
+    inet_ntoa_r(local, local_ip, sizeof(local_ip));
+    inet_ntoa_r(peer, peer_ip, sizeof(peer_ip));
+    char sdp[384];
+    int len = snprintf(sdp, sizeof(sdp),
+        "v=0\r\n"
+        "o=- 0 0 IN IP4 %s\r\n"
+        "s=ESP32CAM Car\r\n"
+        "i=Single receiver: another /rtp.sdp request moves the stream. Sending stops after %d s "
+        "without RTCP receiver reports to the c= address on port %d or a repeated /rtp.sdp request.\r\n"
+        "c=IN IP4 %s\r\n"
+        "t=0 0\r\n"
+        "m=video %d RTP/AVP %d\r\n"
+        "a=rtpmap:%d JPEG/%d\r\n",
+        local_ip, RTP_LEASE_MS / 1000, port + 1,
+        local_ip, port, RTP_JPEG_PT, RTP_JPEG_PT, RTP_JPEG_CLOCK);
+    Serial.printf("RTP to %s:%d", peer_ip, port);
+
+    httpd_resp_set_type(req, "application/sdp");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, sdp, len);
+}
@@ -0,0 +1,125 @@
+/*
+ * @Date: 2026-10-19 10:00:00
+ * @Description: ESP32 Camera Surveillance Car
+ *               Control command trace: ring buffer of every applied command,
+ *               downloadable from /trace for replay with tools/trace_replay.cpp
+ * @FilePath:
+ */
+#include "esp_http_server.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "Arduino.h"
+#include "car_proto.h"
+
+#define TRACE_ENTRIES_PSRAM  4096    //64KB, about 3.5 minutes of /ws at 20Hz
+#define TRACE_ENTRIES_DRAM   512
+#define TRACE_SEND_ENTRIES   64      //entries per HTTP chunk
+
+extern int motor_left;
+extern int motor_right;
+
+int trace_enable = 1;
+
+static uint8_t * trace_buf = NULL;
+static uint32_t trace_capacity = 0;
+static uint32_t trace_head = 0;      //next slot to write
+static uint32_t trace_count = 0;
+static uint32_t trace_lost = 0;
+static bool trace_busy = false;      //download in progress, recording paused
+static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void trace_init(){
+    trace_buf = (uint8_t *)heap_caps_malloc(TRACE_ENTRIES_PSRAM * TRACE_ENTRY_LEN, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    trace_capacity = TRACE_ENTRIES_PSRAM;
+    if(!trace_buf){
+        trace_buf = (uint8_t *)malloc(TRACE_ENTRIES_DRAM * TRACE_ENTRY_LEN);
+        trace_capacity = trace_buf ? TRACE_ENTRIES_DRAM : 0;
+    }
+}
+
+// Records a command that was just applied; motor outputs are read back from setMotor.
+void trace_record(uint8_t source, uint32_t seq, int64_t arrival_us, int throttle, int steer){
+    if(!trace_enable || !trace_capacity){
+        return;
+    }
+    trace_entry_t e;
+    e.time_us = (uint32_t)arrival_us;
+    e.seq = seq;
+    e.source = source;
+    e.throttle = constrain(throttle, -32768, 32767);
+    e.steer = constrain(steer, -32768, 32767);
+    e.left = motor_left;
+    e.right = motor_right;
+
+    portENTER_CRITICAL(&trace_mux);
+    if(!trace_busy){
+        trace_encode_entry(trace_buf + trace_head * TRACE_ENTRY_LEN, &e);
+        trace_head = (trace_head + 1) % trace_capacity;
+        if(trace_count < trace_capacity){
+            trace_count++;
+        } else {
+            trace_lost++;
+        }
+    } else {
+        trace_lost++;       //arrived while the ring was being downloaded
+    }
+    portEXIT_CRITICAL(&trace_mux);
+}
+
+// GET /trace downloads the binary trace, /trace?clear=1 also empties the ring
+esp_err_t trace_handler(httpd_req_t *req){
+    char buf[16];
+    char value[8];
+    bool clear = false;
+
+    size_t buf_len = httpd_req_get_url_query_len(req) + 1;
+    if(buf_len > 1 && buf_len <= sizeof(buf) &&
+       httpd_req_get_url_query_str(req, buf, buf_len) == ESP_OK &&
+       httpd_query_key_value(buf, "clear", value, sizeof(value)) == ESP_OK){
+        clear = atoi(value) != 0;
+    }
+
+    portENTER_CRITICAL(&trace_mux);
+    trace_busy = true;
+    uint32_t count = trace_count;
+    uint32_t lost = trace_lost;
+    uint32_t first = trace_capacity ? (trace_head + trace_capacity - count) % trace_capacity : 0;
+    portEXIT_CRITICAL(&trace_mux);
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=control.trace");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    uint8_t header[TRACE_HEADER_LEN];
+    trace_encode_header(header, count, lost);
+    esp_err_t res = httpd_resp_send_chunk(req, (const char *)header, sizeof(header));
+    for(uint32_t i = 0; res == ESP_OK && i < count; ){
+        uint32_t slot = (first + i) % trace_capacity;
+        uint32_t n = count - i;
+        if(n > TRACE_SEND_ENTRIES){
+            n = TRACE_SEND_ENTRIES;
+        }
+        if(n > trace_capacity - slot){
+            n = trace_capacity - slot;      //stop at the end of the ring
+        }
+        res = httpd_resp_send_chunk(req, (const char *)trace_buf + slot * TRACE_ENTRY_LEN, n * TRACE_ENTRY_LEN);
+        i += n;
+    }
+    if(res == ESP_OK){
+        res = httpd_resp_send_chunk(req, NULL, 0);
+    }
+
+    portENTER_CRITICAL(&trace_mux);
+    if(clear && res == ESP_OK){
+        trace_head = 0;
+        trace_count = 0;
+        trace_lost = 0;
+    }
+    trace_busy = false;
+    portEXIT_CRITICAL(&trace_mux);
+    return res;
+}
+
+uint32_t trace_entries(){
+    return trace_count;
+}
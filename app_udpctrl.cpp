@@ -0,0 +1,104 @@
+/*
+ * @Date: 2026-10-19 10:00:00
+ * @Description: ESP32 Camera Surveillance Car
+ *               UDP control listener, runs beside the /ws endpoint
+ * @FilePath:
+ */
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "car_proto.h"
+#include "Arduino.h"
+
+extern int motor_left;
+extern int motor_right;
+extern int ctrl_dscp;
+
+void Drive(int throttle, int steer);
+void power_kick();
+void trace_record(uint8_t source, uint32_t seq, int64_t arrival_us, int throttle, int steer);
+
+udp_ctrl_state_t udp_ctrl_state;
+
+// Every datagram carries a full command, so a lost one is simply replaced by
+// the next instead of stalling the ones behind it as TCP would. All queued
+// datagrams are drained before acting and only the newest one is applied.
+static void udp_ctrl_task(void * arg){
+    int sock = (int)(intptr_t)arg;
+    uint8_t buf[32];
+    struct sockaddr_in from, newest_from;
+    int64_t newest_at = 0;
+    socklen_t from_len;
+    int dscp = -1;
+
+    while(true){
+        if(dscp != ctrl_dscp){
+            dscp = ctrl_dscp;
+            int tos = dscp << 2;   //same access category as /ws control
+            setsockopt(sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+        }
+
+        udp_ctrl_batch_t batch = {};
+        bool was_active = udp_ctrl_state.active;
+        int flags = 0;
+        while(true){
+            from_len = sizeof(from);
+            int len = recvfrom(sock, buf, sizeof(buf), flags, (struct sockaddr *)&from, &from_len);
+            if(len < 0){
+                break;
+            }
+            flags = MSG_DONTWAIT;
+            if(udp_ctrl_batch_add(&batch, &udp_ctrl_state, buf, len, millis())){
+                newest_from = from;
+                newest_at = esp_timer_get_time();
+            }
+        }
+
+        if(batch.have){
+            udp_ctrl_cmd_t newest = batch.cmd;
+            if(!was_active){
+                power_kick();
+            }
+            Drive(newest.throttle, newest.steer);
+            trace_record(TRACE_SRC_UDP, newest.seq, newest_at, newest.throttle, newest.steer);
+
+            udp_ctrl_ack_t ack;
+            ack.seq = newest.seq;
+            ack.stamp = newest.stamp;
+            ack.left = motor_left;
+            ack.right = motor_right;
+            ack.discarded = udp_ctrl_state.discarded;
+            size_t len = udp_ctrl_encode_ack(buf, &ack);
+            sendto(sock, buf, len, 0, (struct sockaddr *)&newest_from, sizeof(newest_from));
+        } else if(udp_ctrl_expired(&udp_ctrl_state, millis())){
+            // driver vanished mid-manoeuvre, don't keep rolling
+            Drive(0, 0);
+            trace_record(TRACE_SRC_TIMEOUT, 0, esp_timer_get_time(), 0, 0);
+        }
+    }
+}
+
+void startUdpControl(){
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if(sock < 0){
+        Serial.printf("UDP control socket failed");
+        return;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(UDP_CTRL_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+        Serial.printf("UDP control bind failed");
+        close(sock);
+        return;
+    }
+
+    // wake up regularly so the command timeout is enforced
+    struct timeval tv = {0, 100 * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    Serial.printf("Starting UDP control on port: '%d'", UDP_CTRL_PORT);
+    xTaskCreate(udp_ctrl_task, "udp_ctrl", 4096, (void *)(intptr_t)sock, 6, NULL);
+}
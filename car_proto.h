@@ -0,0 +1,439 @@
+/*
+ * @Date: 2026-10-19 10:00:00
+ * @Description: ESP32 Camera Surveillance Car
+ *               Control math and wire formats shared by the firmware and the
+ *               Linux tools in tools/, keep it free of Arduino/ESP-IDF includes.
+ * @FilePath:
+ */
+#ifndef CAR_PROTO_H
+#define CAR_PROTO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+// throttle/steer (-100 ~ +100) -> left/right motor (-100 ~ +100)
+static inline void drive_mix(int throttle, int steer, int * left, int * right){
+    int l = throttle + steer;
+    int r = throttle - steer;
+    *left  = l < -100 ? -100 : (l > 100 ? 100 : l);
+    *right = r < -100 ? -100 : (r > 100 ? 100 : r);
+}
+
+/*
+ * UDP control: every datagram is self-contained, little endian.
+ *
+ * command (client -> car), UDP_CTRL_CMD_LEN bytes
+ *   0  u16 magic 'UC'   2  u8 version   3  u8 flags
+ *   4  u32 seq          8  u32 client timestamp (ms)
+ *   12 i16 throttle     14 i16 steer    (full /ws range, the web UI goes to +-300)
+ *
+ * ack (car -> client), UDP_CTRL_ACK_LEN bytes
+ *   0  u16 magic 'UA'   2  u8 version   3  u8 flags
+ *   4  u32 newest applied seq             8  u32 its client timestamp
+ *   12 i8 left motor    13 i8 right motor 14 u16 discarded (stale/dup) count
+ */
+#define UDP_CTRL_PORT        8282
+#define UDP_CTRL_VERSION     2      //2: throttle/steer widened to i16
+#define UDP_CTRL_CMD_MAGIC   0x4355
+#define UDP_CTRL_ACK_MAGIC   0x4155
+#define UDP_CTRL_CMD_LEN     16
+#define UDP_CTRL_ACK_LEN     16
+#define UDP_CTRL_TIMEOUT_MS  500    //no command for this long -> motors stop
+#define UDP_CTRL_RESYNC_MS   1000   //after this much silence any seq is accepted
+
+typedef struct {
+        uint32_t seq;
+        uint32_t stamp;
+        int16_t throttle;
+        int16_t steer;
+} udp_ctrl_cmd_t;
+
+typedef struct {
+        uint32_t seq;
+        uint32_t stamp;
+        int8_t left;
+        int8_t right;
+        uint16_t discarded;
+} udp_ctrl_ack_t;
+
+typedef struct {
+        bool active;          //a client is driving, motors follow it
+        uint32_t last_seq;
+        uint32_t last_stamp;
+        uint32_t last_rx_ms;
+        uint32_t accepted;
+        uint32_t discarded;
+} udp_ctrl_state_t;
+
+static inline void proto_put_u16(uint8_t * p, uint16_t v){
+    p[0] = v; p[1] = v >> 8;
+}
+
+static inline void proto_put_u32(uint8_t * p, uint32_t v){
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static inline uint16_t proto_get_u16(const uint8_t * p){
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t proto_get_u32(const uint8_t * p){
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void proto_put_be16(uint8_t * p, uint16_t v){
+    p[0] = v >> 8; p[1] = v;
+}
+
+static inline void proto_put_be32(uint8_t * p, uint32_t v){
+    p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static inline uint16_t proto_get_be16(const uint8_t * p){
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t proto_get_be32(const uint8_t * p){
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline size_t udp_ctrl_encode_cmd(uint8_t * buf, const udp_ctrl_cmd_t * cmd){
+    proto_put_u16(buf, UDP_CTRL_CMD_MAGIC);
+    buf[2] = UDP_CTRL_VERSION;
+    buf[3] = 0;
+    proto_put_u32(buf + 4, cmd->seq);
+    proto_put_u32(buf + 8, cmd->stamp);
+    proto_put_u16(buf + 12, (uint16_t)cmd->throttle);
+    proto_put_u16(buf + 14, (uint16_t)cmd->steer);
+    return UDP_CTRL_CMD_LEN;
+}
+
+static inline bool udp_ctrl_decode_cmd(const uint8_t * buf, size_t len, udp_ctrl_cmd_t * cmd){
+    if(len < UDP_CTRL_CMD_LEN || proto_get_u16(buf) != UDP_CTRL_CMD_MAGIC || buf[2] != UDP_CTRL_VERSION){
+        return false;
+    }
+    cmd->seq = proto_get_u32(buf + 4);
+    cmd->stamp = proto_get_u32(buf + 8);
+    cmd->throttle = (int16_t)proto_get_u16(buf + 12);
+    cmd->steer = (int16_t)proto_get_u16(buf + 14);
+    return true;
+}
+
+static inline size_t udp_ctrl_encode_ack(uint8_t * buf, const udp_ctrl_ack_t * ack){
+    proto_put_u16(buf, UDP_CTRL_ACK_MAGIC);
+    buf[2] = UDP_CTRL_VERSION;
+    buf[3] = 0;
+    proto_put_u32(buf + 4, ack->seq);
+    proto_put_u32(buf + 8, ack->stamp);
+    buf[12] = (uint8_t)ack->left;
+    buf[13] = (uint8_t)ack->right;
+    proto_put_u16(buf + 14, ack->discarded);
+    return UDP_CTRL_ACK_LEN;
+}
+
+static inline bool udp_ctrl_decode_ack(const uint8_t * buf, size_t len, udp_ctrl_ack_t * ack){
+    if(len < UDP_CTRL_ACK_LEN || proto_get_u16(buf) != UDP_CTRL_ACK_MAGIC || buf[2] != UDP_CTRL_VERSION){
+        return false;
+    }
+    ack->seq = proto_get_u32(buf + 4);
+    ack->stamp = proto_get_u32(buf + 8);
+    ack->left = (int8_t)buf[12];
+    ack->right = (int8_t)buf[13];
+    ack->discarded = proto_get_u16(buf + 14);
+    return true;
+}
+
+// Returns true when cmd is newer than anything applied so far and should
+// drive the motors. Older and duplicate sequence numbers are counted and
+// dropped; after a long silence the sequence restarts (client restarted).
+static inline bool udp_ctrl_accept(udp_ctrl_state_t * st, const udp_ctrl_cmd_t * cmd, uint32_t now_ms){
+    bool resync = !st->accepted || (uint32_t)(now_ms - st->last_rx_ms) > UDP_CTRL_RESYNC_MS;
+    if(!resync && (int32_t)(cmd->seq - st->last_seq) <= 0){
+        st->discarded++;
+        return false;
+    }
+    st->active = true;
+    st->last_seq = cmd->seq;
+    st->last_stamp = cmd->stamp;
+    st->last_rx_ms = now_ms;
+    st->accepted++;
+    return true;
+}
+
+// One pass over the receive queue: every datagram read before acting is fed
+// in, and only the newest accepted command is applied afterwards. Stale and
+// duplicate ones are discarded by udp_ctrl_accept on the way.
+typedef struct {
+        bool have;
+        udp_ctrl_cmd_t cmd;
+} udp_ctrl_batch_t;
+
+// Returns true when the datagram is now the batch's newest command
+static inline bool udp_ctrl_batch_add(udp_ctrl_batch_t * b, udp_ctrl_state_t * st,
+                                      const uint8_t * buf, size_t len, uint32_t now_ms){
+    udp_ctrl_cmd_t cmd;
+    if(!udp_ctrl_decode_cmd(buf, len, &cmd) || !udp_ctrl_accept(st, &cmd, now_ms)){
+        return false;
+    }
+    b->cmd = cmd;
+    b->have = true;
+    return true;
+}
+
+// True once the driving client went quiet long enough that the motors must stop.
+static inline bool udp_ctrl_expired(udp_ctrl_state_t * st, uint32_t now_ms){
+    if(st->active && (uint32_t)(now_ms - st->last_rx_ms) > UDP_CTRL_TIMEOUT_MS){
+        st->active = false;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Control trace, as downloaded from /trace. Little endian.
+ *
+ * header, TRACE_HEADER_LEN bytes
+ *   0  "CTRC"           4  u16 version   6  u16 entry length
+ *   8  u32 entry count  12 u32 entries lost to ring wrap-around
+ * entry, TRACE_ENTRY_LEN bytes, oldest first
+ *   0  u32 arrival time (us, low 32 bits of the device clock)
+ *   4  u32 seq (UDP: datagram seq, others: per-source arrival counter)
+ *   8  u8 source   9  i8 left motor   10 i8 right motor   11 reserved
+ *   12 i16 throttle    14 i16 steer (as received, before clamping)
+ */
+#define TRACE_MAGIC          "CTRC"
+#define TRACE_VERSION        1
+#define TRACE_HEADER_LEN     16
+#define TRACE_ENTRY_LEN      16
+
+typedef enum {
+        TRACE_SRC_WS = 0,    //JSON over /ws
+        TRACE_SRC_UDP,       //UDP control port
+        TRACE_SRC_HTTP,      //button endpoints, stored as the equivalent throttle/steer
+        TRACE_SRC_TIMEOUT    //motors stopped by the UDP command timeout
+} trace_source_t;
+
+typedef struct {
+        uint32_t time_us;
+        uint32_t seq;
+        uint8_t source;
+        int8_t left;
+        int8_t right;
+        int16_t throttle;
+        int16_t steer;
+} trace_entry_t;
+
+static inline void trace_encode_header(uint8_t * buf, uint32_t count, uint32_t lost){
+    memcpy(buf, TRACE_MAGIC, 4);
+    proto_put_u16(buf + 4, TRACE_VERSION);
+    proto_put_u16(buf + 6, TRACE_ENTRY_LEN);
+    proto_put_u32(buf + 8, count);
+    proto_put_u32(buf + 12, lost);
+}
+
+static inline bool trace_decode_header(const uint8_t * buf, uint32_t * count, uint32_t * lost){
+    if(memcmp(buf, TRACE_MAGIC, 4) || proto_get_u16(buf + 4) != TRACE_VERSION ||
+       proto_get_u16(buf + 6) != TRACE_ENTRY_LEN){
+        return false;
+    }
+    *count = proto_get_u32(buf + 8);
+    *lost = proto_get_u32(buf + 12);
+    return true;
+}
+
+static inline void trace_encode_entry(uint8_t * buf, const trace_entry_t * e){
+    proto_put_u32(buf, e->time_us);
+    proto_put_u32(buf + 4, e->seq);
+    buf[8] = e->source;
+    buf[9] = (uint8_t)e->left;
+    buf[10] = (uint8_t)e->right;
+    buf[11] = 0;
+    proto_put_u16(buf + 12, (uint16_t)e->throttle);
+    proto_put_u16(buf + 14, (uint16_t)e->steer);
+}
+
+static inline void trace_decode_entry(const uint8_t * buf, trace_entry_t * e){
+    e->time_us = proto_get_u32(buf);
+    e->seq = proto_get_u32(buf + 4);
+    e->source = buf[8];
+    e->left = (int8_t)buf[9];
+    e->right = (int8_t)buf[10];
+    e->throttle = (int16_t)proto_get_u16(buf + 12);
+    e->steer = (int16_t)proto_get_u16(buf + 14);
+}
+
+/*
+ * RTP/JPEG (RFC 2435). Baseline JPEGs with standard Huffman tables, as the
+ * camera produces them, are split into the quantization tables (sent in-band,
+ * Q=255, with the first fragment) and the entropy coded scan, which is cut
+ * into MTU sized fragments. Receivers rebuild the JPEG headers themselves.
+ */
+#define RTP_JPEG_PT          26
+#define RTP_JPEG_CLOCK       90000
+#define RTP_JPEG_MTU         1400   //whole RTP packet, clear of the 1500 byte link MTU
+#define RTP_HEADER_LEN       12
+#define RTP_JPEG_HEADER_LEN  8
+#define RTP_JPEG_DEFAULT_PORT 5004
+#define RTP_LEASE_MS         30000  //sending stops unless /rtp.sdp or an RTCP RR renews it
+#define RTCP_PT_RR           201
+#define RTCP_RR_LEN          8      //header and reporter SSRC, no report blocks
+
+typedef struct {
+        uint8_t type;           //0: 4:2:2, 1: 4:2:0, +64 with restart markers
+        uint8_t width8;         //width / 8
+        uint8_t height8;        //height / 8
+        uint16_t dri;           //restart interval, 0 without restart markers
+        uint16_t qlen;
+        uint8_t qtables[128];   //luma then chroma, zigzag order as in DQT
+        const uint8_t * scan;   //entropy coded data between SOS header and EOI
+        size_t scan_len;
+} rtp_jpeg_t;
+
+static inline bool rtp_jpeg_parse(const uint8_t * jpg, size_t len, rtp_jpeg_t * j){
+    if(len < 4 || jpg[0] != 0xFF || jpg[1] != 0xD8){
+        return false;
+    }
+    memset(j, 0, sizeof(*j));
+    bool sof = false;
+    size_t i = 2;
+    while(i + 4 <= len){
+        if(jpg[i] != 0xFF){
+            return false;
+        }
+        uint8_t marker = jpg[i + 1];
+        if(marker == 0xFF){     //fill byte
+            i++;
+            continue;
+        }
+        size_t seg_len = proto_get_be16(jpg + i + 2);
+        if(seg_len < 2 || i + 2 + seg_len > len){
+            return false;
+        }
+        const uint8_t * seg = jpg + i + 4;
+        size_t body = seg_len - 2;
+
+        if(marker == 0xDB){                             //DQT, one or more tables
+            for(size_t k = 0; k < body; k += 65){
+                uint8_t id = seg[k] & 0x0F;
+                if((seg[k] >> 4) != 0 || id > 1 || k + 65 > body){
+                    return false;                       //16 bit or extra tables
+                }
+                memcpy(j->qtables + id * 64, seg + k + 1, 64);
+                if(j->qlen < (id + 1) * 64){
+                    j->qlen = (id + 1) * 64;
+                }
+            }
+        } else if(marker == 0xC0){                      //baseline SOF
+            if(body < 15 || seg[5] != 3){
+                return false;
+            }
+            uint16_t height = proto_get_be16(seg + 1);
+            uint16_t width = proto_get_be16(seg + 3);
+            if(!width || !height || width > 2040 || height > 2040 ||
+               seg[10] != 0x11 || seg[13] != 0x11){
+                return false;
+            }
+            if(seg[7] == 0x21){
+                j->type = 0;
+            } else if(seg[7] == 0x22){
+                j->type = 1;
+            } else {
+                return false;
+            }
+            j->width8 = (width + 7) / 8;
+            j->height8 = (height + 7) / 8;
+            sof = true;
+        } else if(marker >= 0xC1 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC){
+            return false;                               //progressive, lossless, arithmetic
+        } else if(marker == 0xDD && body >= 2){         //DRI
+            j->dri = proto_get_be16(seg);
+        } else if(marker == 0xDA){                      //SOS, scan runs to EOI
+            if(!sof || j->qlen != 128){
+                return false;
+            }
+            j->scan = seg + body;
+            j->scan_len = len - (i + 2 + seg_len);
+            while(j->scan_len >= 2 && !(j->scan[j->scan_len - 2] == 0xFF && j->scan[j->scan_len - 1] == 0xD9)){
+                j->scan_len--;                          //padding after EOI
+            }
+            if(j->scan_len < 2){
+                return false;
+            }
+            j->scan_len -= 2;
+            if(j->dri){
+                j->type += 64;
+            }
+            return true;
+        }
+        i += 2 + seg_len;
+    }
+    return false;
+}
+
+// Writes the next fragment of the frame into pkt (at most mtu bytes) and
+// advances *offset; returns the packet length, 0 once the scan is consumed.
+static inline size_t rtp_jpeg_packet(const rtp_jpeg_t * j, size_t * offset, uint16_t seq,
+                                     uint32_t ts, uint32_t ssrc, uint8_t * pkt, size_t mtu){
+    if(*offset >= j->scan_len){
+        return 0;
+    }
+    size_t hlen = RTP_HEADER_LEN + RTP_JPEG_HEADER_LEN + (j->dri ? 4 : 0) + (*offset == 0 ? 4 + j->qlen : 0);
+    if(mtu <= hlen){
+        return 0;
+    }
+    size_t chunk = j->scan_len - *offset;
+    if(chunk > mtu - hlen){
+        chunk = mtu - hlen;
+    }
+    bool last = *offset + chunk == j->scan_len;
+
+    uint8_t * p = pkt;
+    p[0] = 0x80;                                        //V=2
+    p[1] = (last ? 0x80 : 0) | RTP_JPEG_PT;             //marker on the last fragment
+    proto_put_be16(p + 2, seq);
+    proto_put_be32(p + 4, ts);
+    proto_put_be32(p + 8, ssrc);
+    p += RTP_HEADER_LEN;
+
+    proto_put_be32(p, *offset);                         //type-specific 0 + 24 bit offset
+    p[4] = j->type;
+    p[5] = 255;                                         //Q: tables in-band
+    p[6] = j->width8;
+    p[7] = j->height8;
+    p += RTP_JPEG_HEADER_LEN;
+
+    if(j->dri){
+        proto_put_be16(p, j->dri);
+        proto_put_be16(p + 2, 0xFFFF);                  //F=L=1, count 0x3FFF
+        p += 4;
+    }
+    if(*offset == 0){
+        p[0] = 0;                                       //MBZ
+        p[1] = 0;                                       //8 bit precision
+        proto_put_be16(p + 2, j->qlen);
+        memcpy(p + 4, j->qtables, j->qlen);
+        p += 4 + j->qlen;
+    }
+    memcpy(p, j->scan + *offset, chunk);
+    *offset += chunk;
+    return hlen + chunk;
+}
+
+// Empty RTCP receiver report (RFC 3550 6.4.2), enough to keep the car sending.
+// The car listens for it on its RTP source port + 1.
+static inline size_t rtcp_encode_rr(uint8_t * buf, uint32_t ssrc){
+    buf[0] = 0x80;
+    buf[1] = RTCP_PT_RR;
+    proto_put_be16(buf + 2, RTCP_RR_LEN / 4 - 1);
+    proto_put_be32(buf + 4, ssrc);
+    return RTCP_RR_LEN;
+}
+
+// True for a compound RTCP packet opening with a receiver report
+static inline bool rtcp_is_rr(const uint8_t * buf, size_t len){
+    return len >= RTCP_RR_LEN && (buf[0] >> 6) == 2 && buf[1] == RTCP_PT_RR;
+}
+
+#endif
@@ -0,0 +1,37 @@
+/*
+ * @Date: 2026-10-19 10:00:00
+ * @Description: ESP32 Camera Surveillance Car
+ *               Frame hub shared between the stream servers in app_httpd.cpp
+ *               and the other video senders (app_rtp.cpp)
+ * @FilePath:
+ */
+#ifndef FRAME_HUB_H
+#define FRAME_HUB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+        STREAM_FULL = 0, //frame as captured, served on /stream
+        STREAM_PREVIEW,  //scaled down re-encode, served on /preview
+        STREAM_VARIANTS
+} stream_variant_t;
+
+typedef struct {
+        int refs; //hub slot + viewers still sending this frame
+        int64_t stamp_us; //esp_timer time the frame was captured
+        size_t len;
+        uint8_t * buf;
+} shared_frame_t;
+
+void hub_subscribe(stream_variant_t v, int delta);
+int hub_viewer_count(stream_variant_t v);
+shared_frame_t * hub_wait_frame(stream_variant_t v, uint32_t * seq);
+shared_frame_t * hub_wait_frame_for(stream_variant_t v, uint32_t * seq, uint32_t timeout_ms);
+void frame_release(shared_frame_t * f);
+
+// video bandwidth cap shared by every video sender, see app_httpd.cpp
+int64_t video_bucket_charge(size_t len);
+extern int video_dscp;
+
+#endif
@@ -0,0 +1,1259 @@
+/*
+ * @Date: 2026-10-19 10:00:00
+ * @Description: ESP32 Camera Surveillance Car
+ *               Linux relay: one upstream /stream and one /ws connection per
+ *               car, fanned out to any number of viewers on the LAN, plus
+ *               fleet-wide metrics. Also contains a stand-in car for testing.
+ *
+ *   g++ -std=c++17 -O2 -Wall -pthread -o car_relay tools/car_relay.cpp
+ *
+ *   ./car_relay -p 8080 front=192.168.4.1 back=192.168.1.42
+ *       http://<relay>:8080/                   index of cars
+ *       http://<relay>:8080/front/stream       MJPEG, same format as :81/stream
+ *       http://<relay>:8080/front/snapshot     latest frame
+ *       ws://<relay>:8080/front/ws             control, same messages as :82/ws
+ *       ws://<relay>:8080/front/ws?video=1     control plus binary JPEG frames
+ *       http://<relay>:8080/metrics            JSON for the whole fleet
+ *
+ *   ./car_relay standin -P 8000 -r 15 a.jpg b.jpg   # car on 8000/8001/8002
+ *   ./car_relay -p 8080 sim=127.0.0.1:8000
+ *
+ * Cars are given as name=host[:base]; /stats, /stream and /ws are expected on
+ * base, base+1 and base+2 (80/81/82 on the real car). Upstream connections
+ * are only held while somebody watches or drives, so an unwatched car can
+ * drop into its idle power state.
+ *
+ * Every viewer has its own thread and always gets the newest frame; a slow
+ * viewer skips frames instead of holding up the upstream or other viewers.
+ * Control messages from all drivers go through the single upstream /ws in
+ * arrival order and each {"c":..} echo is matched on its value and routed back
+ * to the viewer whose message caused it, so the browser's RTT still covers the
+ * whole path.
+ * @FilePath:
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../car_proto.h"
+
+#define RELAY_IDLE_MS       5000    //upstream kept this long after the last viewer left
+#define RELAY_RETRY_MS      1000
+#define RELAY_TIMEOUT_S     5       //upstream silent this long is considered dead
+#define RELAY_ECHO_MAX      64      //unanswered control frames remembered per car
+#define RELAY_SNDBUF_SIZE   (32 * 1024) //per viewer, keeps frames queued in the kernel to about one
+
+#define WS_OP_CONT          0x0
+#define WS_OP_TEXT          0x1
+#define WS_OP_BINARY        0x2
+#define WS_OP_CLOSE         0x8
+#define WS_OP_PING          0x9
+#define WS_OP_PONG          0xA
+#define WS_MAX_PAYLOAD      (4 << 20)
+
+#define PART_BOUNDARY "123456789000000000000987654321"
+static const char * STREAM_RESP_HEADER = "HTTP/1.1 200 OK\r\n"
+    "Content-Type: multipart/x-mixed-replace;boundary=" PART_BOUNDARY "\r\n"
+    "Access-Control-Allow-Origin: *\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: close\r\n\r\n";
+// Like the firmware, every part is closed by the next boundary so a browser shows
+// it on arrival instead of when the following frame starts
+static const char * STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
+static const char * STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %zu\r\nX-Timestamp: %s\r\n\r\n";
+
+static int64_t now_us(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Same lookup the car uses to pick "c" out of a control frame, so both agree on the value
+static bool json_int(const std::string & msg, const char * key, int * val){
+    char pattern[16];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    size_t at = msg.find(pattern);
+    if(at == std::string::npos){
+        return false;
+    }
+    const char * start = msg.c_str() + at + strlen(pattern);
+    char * end = NULL;
+    long v = strtol(start, &end, 10);
+    if(end == start){
+        return false;
+    }
+    *val = (int)v;
+    return true;
+}
+
+static bool send_all(int sock, const void * data, size_t len){
+    const char * p = (const char *)data;
+    while(len > 0){
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if(n <= 0){
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool send_str(int sock, const std::string & s){
+    return send_all(sock, s.data(), s.size());
+}
+
+// One sendmsg per MJPEG part, so the short trailing boundary never waits on Nagle
+static bool send_part(int sock, const std::string & jpeg, const char * stamp){
+    char part[160];
+    struct iovec iov[3];
+    iov[0].iov_base = part;
+    iov[0].iov_len = snprintf(part, sizeof(part), STREAM_PART, jpeg.size(), stamp);
+    iov[1].iov_base = (void *)jpeg.data();
+    iov[1].iov_len = jpeg.size();
+    iov[2].iov_base = (void *)STREAM_BOUNDARY;
+    iov[2].iov_len = strlen(STREAM_BOUNDARY);
+    struct iovec * left = iov;
+    int count = 3;
+    while(count > 0){
+        struct msghdr mh = {};
+        mh.msg_iov = left;
+        mh.msg_iovlen = count;
+        ssize_t n = sendmsg(sock, &mh, MSG_NOSIGNAL);
+        if(n <= 0){
+            return false;
+        }
+        while(count > 0 && (size_t)n >= left->iov_len){
+            n -= left->iov_len;
+            left++;
+            count--;
+        }
+        if(count > 0){
+            left->iov_base = (char *)left->iov_base + n;
+            left->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+static bool read_line(int sock, std::string * buf, std::string * line){
+    while(true){
+        size_t nl = buf->find("\r\n");
+        if(nl != std::string::npos){
+            *line = buf->substr(0, nl);
+            buf->erase(0, nl + 2);
+            return true;
+        }
+        char tmp[4096];
+        ssize_t n = recv(sock, tmp, sizeof(tmp), 0);
+        if(n <= 0){
+            return false;
+        }
+        buf->append(tmp, n);
+    }
+}
+
+static bool read_bytes(int sock, std::string * buf, size_t len){
+    while(buf->size() < len){
+        char tmp[16384];
+        ssize_t n = recv(sock, tmp, sizeof(tmp), 0);
+        if(n <= 0){
+            return false;
+        }
+        buf->append(tmp, n);
+    }
+    return true;
+}
+
+static void set_timeout(int sock, int seconds){
+    struct timeval tv = {seconds, 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));   //also bounds connect()
+}
+
+// Unlike the probes this returns -1 instead of exiting, the relay retries
+static int tcp_connect(const char * host, int port){
+    struct addrinfo hints, * res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    if(getaddrinfo(host, port_str, &hints, &res) != 0){
+        return -1;
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if(sock >= 0){
+        int on = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        set_timeout(sock, RELAY_TIMEOUT_S);
+        if(connect(sock, res->ai_addr, res->ai_addrlen) < 0){
+            close(sock);
+            sock = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+static int tcp_listen(int port){
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(sock, 16) < 0){
+        perror("listen");
+        exit(1);
+    }
+    return sock;
+}
+
+/* ---------------- minimal HTTP server ---------------- */
+
+typedef struct {
+        std::string method;
+        std::string path;
+        std::string query;
+        std::map<std::string, std::string> headers;     //names lower-cased
+        std::string rest;                               //bytes read past the header
+} http_req_t;
+
+static bool http_read_request(int sock, http_req_t * req){
+    std::string line;
+    if(!read_line(sock, &req->rest, &line)){
+        return false;
+    }
+    size_t sp1 = line.find(' '), sp2 = line.rfind(' ');
+    if(sp1 == std::string::npos || sp2 <= sp1){
+        return false;
+    }
+    req->method = line.substr(0, sp1);
+    std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    size_t q = target.find('?');
+    req->path = target.substr(0, q);
+    req->query = q == std::string::npos ? "" : target.substr(q + 1);
+    while(read_line(sock, &req->rest, &line) && !line.empty()){
+        size_t colon = line.find(':');
+        if(colon == std::string::npos){
+            continue;
+        }
+        std::string name = line.substr(0, colon);
+        for(char & c : name){
+            c = tolower(c);
+        }
+        size_t v = line.find_first_not_of(' ', colon + 1);
+        req->headers[name] = v == std::string::npos ? "" : line.substr(v);
+    }
+    return true;
+}
+
+static std::string query_value(const std::string & query, const char * key){
+    std::string k = std::string(key) + "=";
+    size_t pos = 0;
+    while(pos < query.size()){
+        size_t end = query.find('&', pos);
+        if(end == std::string::npos){
+            end = query.size();
+        }
+        if(query.compare(pos, k.size(), k) == 0){
+            return query.substr(pos + k.size(), end - pos - k.size());
+        }
+        pos = end + 1;
+    }
+    return "";
+}
+
+static void http_reply(int sock, const char * status, const char * type, const std::string & body){
+    char head[256];
+    snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+             "Access-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n", status, type, body.size());
+    if(send_all(sock, head, strlen(head))){
+        send_str(sock, body);
+    }
+}
+
+typedef std::function<void(int, http_req_t *)> http_handler_t;
+
+// One thread per connection, the handler owns the socket until it returns
+static void http_serve(int port, http_handler_t handler){
+    int listener = tcp_listen(port);
+    std::thread([listener, handler](){
+        while(true){
+            int sock = accept(listener, NULL, NULL);
+            if(sock < 0){
+                continue;
+            }
+            std::thread([sock, handler](){
+                int on = 1;
+                setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                http_req_t req;
+                if(http_read_request(sock, &req)){
+                    handler(sock, &req);
+                }
+                close(sock);
+            }).detach();
+        }
+    }).detach();
+}
+
+/* ---------------- WebSocket (RFC 6455) ---------------- */
+
+static void sha1(const uint8_t * data, size_t len, uint8_t out[20]){
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    std::string msg((const char *)data, len);
+    msg += (char)0x80;
+    while(msg.size() % 64 != 56){
+        msg += (char)0;
+    }
+    uint64_t bits = (uint64_t)len * 8;
+    for(int i = 7; i >= 0; i--){
+        msg += (char)(bits >> (i * 8));
+    }
+    for(size_t off = 0; off < msg.size(); off += 64){
+        uint32_t w[80];
+        for(int i = 0; i < 16; i++){
+            w[i] = proto_get_be32((const uint8_t *)msg.data() + off + i * 4);
+        }
+        for(int i = 16; i < 80; i++){
+            uint32_t x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+            w[i] = (x << 1) | (x >> 31);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for(int i = 0; i < 80; i++){
+            uint32_t f, k;
+            if(i < 20){
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if(i < 40){
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if(i < 60){
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t t = ((a << 5) | (a >> 27)) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = (b << 30) | (b >> 2);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    for(int i = 0; i < 5; i++){
+        proto_put_be32(out + i * 4, h[i]);
+    }
+}
+
+static std::string base64(const uint8_t * data, size_t len){
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for(size_t i = 0; i < len; i += 3){
+        uint32_t v = data[i] << 16;
+        if(i + 1 < len) v |= data[i + 1] << 8;
+        if(i + 2 < len) v |= data[i + 2];
+        out += table[(v >> 18) & 63];
+        out += table[(v >> 12) & 63];
+        out += i + 1 < len ? table[(v >> 6) & 63] : '=';
+        out += i + 2 < len ? table[v & 63] : '=';
+    }
+    return out;
+}
+
+static std::string ws_accept_key(const std::string & key){
+    std::string s = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    uint8_t digest[20];
+    sha1((const uint8_t *)s.data(), s.size(), digest);
+    return base64(digest, sizeof(digest));
+}
+
+static bool ws_server_handshake(int sock, http_req_t * req){
+    auto key = req->headers.find("sec-websocket-key");
+    if(key == req->headers.end() || strcasecmp(req->headers["upgrade"].c_str(), "websocket") != 0){
+        http_reply(sock, "400 Bad Request", "text/plain", "websocket expected\n");
+        return false;
+    }
+    return send_str(sock, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                          "Sec-WebSocket-Accept: " + ws_accept_key(key->second) + "\r\n\r\n");
+}
+
+// Client frames must be masked, server frames must not. Header and payload
+// go out in one write so a small control message is one segment.
+static bool ws_send(int sock, int opcode, const void * data, size_t len, bool mask){
+    uint8_t head[14];
+    size_t n = 0;
+    head[n++] = 0x80 | opcode;
+    uint8_t m = mask ? 0x80 : 0;
+    if(len < 126){
+        head[n++] = m | len;
+    } else if(len < 65536){
+        head[n++] = m | 126;
+        proto_put_be16(head + n, len);
+        n += 2;
+    } else {
+        head[n++] = m | 127;
+        proto_put_be32(head + n, (uint64_t)len >> 32);
+        proto_put_be32(head + n + 4, (uint32_t)len);
+        n += 8;
+    }
+    if(mask){
+        proto_put_be32(head + n, rand());
+        n += 4;
+    }
+    std::string frame((const char *)head, n);
+    frame.append((const char *)data, len);
+    if(mask){
+        for(size_t i = 0; i < len; i++){
+            frame[n + i] ^= head[n - 4 + (i & 3)];
+        }
+    }
+    return send_str(sock, frame);
+}
+
+// Reads one message, joining fragments; control frames are returned as they come
+static bool ws_read(int sock, std::string * buf, int * opcode, std::string * payload){
+    payload->clear();
+    *opcode = -1;
+    while(true){
+        if(!read_bytes(sock, buf, 2)){
+            return false;
+        }
+        const uint8_t * p = (const uint8_t *)buf->data();
+        bool fin = p[0] & 0x80;
+        int op = p[0] & 0x0F;
+        bool masked = p[1] & 0x80;
+        uint64_t len = p[1] & 0x7F;
+        size_t hlen = 2;
+        if(len == 126){
+            hlen += 2;
+        } else if(len == 127){
+            hlen += 8;
+        }
+        if(masked){
+            hlen += 4;
+        }
+        if(!read_bytes(sock, buf, hlen)){
+            return false;
+        }
+        p = (const uint8_t *)buf->data();
+        if(len == 126){
+            len = proto_get_be16(p + 2);
+        } else if(len == 127){
+            len = ((uint64_t)proto_get_be32(p + 2) << 32) | proto_get_be32(p + 6);
+        }
+        if(len > WS_MAX_PAYLOAD || !read_bytes(sock, buf, hlen + len)){
+            return false;
+        }
+        std::string data = buf->substr(hlen, len);
+        if(masked){
+            const uint8_t * key = (const uint8_t *)buf->data() + hlen - 4;
+            for(size_t i = 0; i < len; i++){
+                data[i] ^= key[i & 3];
+            }
+        }
+        buf->erase(0, hlen + len);
+
+        if(op >= WS_OP_CLOSE){
+            *opcode = op;
+            *payload = data;
+            return true;
+        }
+        if(op != WS_OP_CONT){
+            *opcode = op;
+            payload->clear();
+        }
+        payload->append(data);
+        if(fin){
+            return *opcode >= 0;
+        }
+    }
+}
+
+/* ---------------- relay ---------------- */
+
+typedef struct {
+        std::string jpeg;
+        std::string stamp;      //car's X-Timestamp, passed through for latency probes
+        int64_t arrival_us;
+} relay_frame_t;
+
+typedef struct {
+        int opcode;
+        std::string data;
+} ws_message_t;
+
+// Fields other than sock are guarded by the car's lock
+typedef struct {
+        int sock;
+        bool alive;
+        bool video;
+        bool drove;                     //sent at least one command
+        std::deque<ws_message_t> outbox; //echoes and pongs for the writer thread
+} ws_viewer_t;
+
+typedef struct {
+        std::weak_ptr<ws_viewer_t> viewer;
+        int stamp;                      //the frame's "c", echoed back verbatim
+        int64_t sent_us;
+} pending_echo_t;
+
+typedef struct {
+        std::string name;
+        std::string host;
+        int base_port;
+
+        std::mutex lock;
+        std::condition_variable frame_cv;   //new frame published
+        std::condition_variable wake_cv;    //viewer count changed
+        std::shared_ptr<const relay_frame_t> frame;
+        uint64_t frame_seq;
+        int video_viewers;
+        int ctrl_viewers;
+        int64_t video_idle_since;
+        int64_t ctrl_idle_since;
+        std::deque<pending_echo_t> echoes;  //ws messages waiting for their {"c":..}
+        std::string car_stats;              //last /stats body, empty when unreachable
+
+        std::mutex ws_send_lock;
+        int ws_sock;                        //-1 while the upstream /ws is down
+
+        // metrics
+        bool stream_up;
+        bool ws_up;
+        uint32_t stream_connects;
+        uint32_t ws_connects;
+        uint64_t frames_in;
+        uint64_t bytes_in;
+        double fps;
+        std::atomic<uint64_t> frames_out;
+        std::atomic<uint64_t> frames_skipped;   //newer frame arrived before a viewer took the previous one
+        std::atomic<uint64_t> ctrl_in;
+        std::atomic<uint64_t> ctrl_fwd;
+        std::atomic<uint64_t> ctrl_dropped;     //upstream /ws was down
+        uint64_t echo_lost;                     //forwarded frames the car never answered
+        uint32_t rtt_last_ms;
+        uint32_t rtt_max_ms;
+        uint32_t stats_errors;
+} relay_car_t;
+
+static std::vector<relay_car_t *> relay_cars;
+static int64_t relay_start_us;
+
+static relay_car_t * relay_find(const std::string & name){
+    for(relay_car_t * car : relay_cars){
+        if(car->name == name){
+            return car;
+        }
+    }
+    return NULL;
+}
+
+// Blocks while nobody needs this upstream; returns once a viewer appears
+static void relay_wait_viewers(relay_car_t * car, int * count){
+    std::unique_lock<std::mutex> l(car->lock);
+    car->wake_cv.wait(l, [count](){ return *count > 0; });
+}
+
+static bool relay_idle(relay_car_t * car, int * count, int64_t * idle_since){
+    std::lock_guard<std::mutex> l(car->lock);
+    return *count == 0 && now_us() - *idle_since > (int64_t)RELAY_IDLE_MS * 1000;
+}
+
+static void relay_publish(relay_car_t * car, std::string jpeg, std::string stamp){
+    auto f = std::make_shared<relay_frame_t>();
+    f->jpeg = std::move(jpeg);
+    f->stamp = std::move(stamp);
+    f->arrival_us = now_us();
+    std::lock_guard<std::mutex> l(car->lock);
+    if(car->frame){
+        double dt = (f->arrival_us - car->frame->arrival_us) / 1e6;
+        if(dt > 0){
+            car->fps = car->fps ? car->fps * 0.9 + 0.1 / dt : 1 / dt;
+        }
+    }
+    car->frames_in++;
+    car->bytes_in += f->jpeg.size();
+    car->frame = f;
+    car->frame_seq++;
+    car->frame_cv.notify_all();
+}
+
+// Reads the car's MJPEG stream; the same parser as rtp_probe mjpeg
+static void relay_stream_task(relay_car_t * car){
+    while(true){
+        relay_wait_viewers(car, &car->video_viewers);
+        int sock = tcp_connect(car->host.c_str(), car->base_port + 1);
+        if(sock < 0){
+            usleep(RELAY_RETRY_MS * 1000);
+            continue;
+        }
+        std::string req = "GET /stream HTTP/1.1\r\nHost: " + car->host + "\r\n\r\n";
+        std::string buf, line;
+        bool ok = send_str(sock, req) && read_line(sock, &buf, &line) && line.find(" 200") != std::string::npos;
+        while(ok && read_line(sock, &buf, &line) && !line.empty()){
+        }
+        if(ok){
+            std::lock_guard<std::mutex> l(car->lock);
+            car->stream_up = true;
+            car->stream_connects++;
+            printf("%s: stream up\n", car->name.c_str());
+        }
+        while(ok && !relay_idle(car, &car->video_viewers, &car->video_idle_since)){
+            size_t content_len = 0;
+            std::string stamp;
+            bool in_part = false;
+            while((ok = read_line(sock, &buf, &line))){
+                if(line.empty()){
+                    if(in_part){
+                        break;
+                    }
+                    continue;
+                }
+                if(line.compare(0, 2, "--") == 0){
+                    in_part = true;
+                } else if(strncasecmp(line.c_str(), "Content-Length:", 15) == 0){
+                    content_len = strtoul(line.c_str() + 15, NULL, 10);
+                } else if(strncasecmp(line.c_str(), "X-Timestamp:", 12) == 0){
+                    stamp = line.substr(line.find_first_not_of(' ', 12));
+                }
+            }
+            if(!ok || !content_len || !read_bytes(sock, &buf, content_len)){
+                break;
+            }
+            relay_publish(car, buf.substr(0, content_len), stamp);
+            buf.erase(0, content_len);
+        }
+        close(sock);
+        {
+            std::lock_guard<std::mutex> l(car->lock);
+            if(car->stream_up){
+                printf("%s: stream down\n", car->name.c_str());
+            }
+            car->stream_up = false;
+        }
+        if(!ok){
+            usleep(RELAY_RETRY_MS * 1000);
+        }
+    }
+}
+
+static bool relay_ws_connect(relay_car_t * car, int sock, std::string * buf){
+    uint8_t nonce[16];
+    for(size_t i = 0; i < sizeof(nonce); i++){
+        nonce[i] = rand();
+    }
+    std::string key = base64(nonce, sizeof(nonce));
+    std::string req = "GET /ws HTTP/1.1\r\nHost: " + car->host + "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                      "Sec-WebSocket-Key: " + key + "\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    std::string line;
+    if(!send_str(sock, req) || !read_line(sock, buf, &line) || line.find(" 101") == std::string::npos){
+        return false;
+    }
+    bool accepted = false;
+    std::string expect = ws_accept_key(key);
+    while(read_line(sock, buf, &line) && !line.empty()){
+        if(strncasecmp(line.c_str(), "Sec-WebSocket-Accept:", 21) == 0){
+            accepted = line.find(expect) != std::string::npos;
+        }
+    }
+    return accepted;
+}
+
+// Routes the car's {"c":..} echo to the viewer whose message it answers.
+// The car handles /ws messages in order, so entries queued before the match
+// were dropped on the way and are discarded; an echo nobody waits for is ignored.
+// Only queued here, a viewer that stopped reading must not stall the others.
+static void relay_route_echo(relay_car_t * car, const std::string & msg){
+    int stamp;
+    if(!json_int(msg, "c", &stamp)){
+        return;
+    }
+    std::lock_guard<std::mutex> l(car->lock);
+    size_t match = 0;
+    while(match < car->echoes.size() && car->echoes[match].stamp != stamp){
+        match++;
+    }
+    if(match == car->echoes.size()){
+        return;
+    }
+    pending_echo_t e = car->echoes[match];
+    car->echoes.erase(car->echoes.begin(), car->echoes.begin() + match + 1);
+    car->echo_lost += match;
+    car->rtt_last_ms = (now_us() - e.sent_us) / 1000;
+    if(car->rtt_last_ms > car->rtt_max_ms){
+        car->rtt_max_ms = car->rtt_last_ms;
+    }
+    std::shared_ptr<ws_viewer_t> v = e.viewer.lock();
+    if(v && v->alive){
+        v->outbox.push_back({WS_OP_TEXT, msg});
+        car->frame_cv.notify_all();
+    }
+}
+
+static void relay_ws_task(relay_car_t * car){
+    while(true){
+        relay_wait_viewers(car, &car->ctrl_viewers);
+        int sock = tcp_connect(car->host.c_str(), car->base_port + 2);
+        std::string buf;
+        if(sock < 0 || !relay_ws_connect(car, sock, &buf)){
+            if(sock >= 0){
+                close(sock);
+            }
+            usleep(RELAY_RETRY_MS * 1000);
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> l(car->ws_send_lock);
+            car->ws_sock = sock;
+        }
+        {
+            std::lock_guard<std::mutex> l(car->lock);
+            car->ws_up = true;
+            car->ws_connects++;
+            car->wake_cv.notify_all();
+            printf("%s: control up\n", car->name.c_str());
+        }
+
+        bool ok = true;
+        while(ok && !relay_idle(car, &car->ctrl_viewers, &car->ctrl_idle_since)){
+            struct pollfd pfd = {sock, POLLIN, 0};
+            if(buf.empty() && poll(&pfd, 1, 1000) == 0){
+                continue;           //the car only talks when spoken to
+            }
+            int op;
+            std::string msg;
+            ok = ws_read(sock, &buf, &op, &msg);
+            if(!ok || op == WS_OP_CLOSE){
+                ok = false;
+            } else if(op == WS_OP_PING){
+                std::lock_guard<std::mutex> l(car->ws_send_lock);
+                ws_send(sock, WS_OP_PONG, msg.data(), msg.size(), true);
+            } else if(op == WS_OP_TEXT){
+                relay_route_echo(car, msg);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> l(car->ws_send_lock);
+            car->ws_sock = -1;
+        }
+        close(sock);
+        {
+            std::lock_guard<std::mutex> l(car->lock);
+            car->echoes.clear();
+            car->ws_up = false;
+            printf("%s: control down\n", car->name.c_str());
+        }
+        if(!ok){
+            usleep(RELAY_RETRY_MS * 1000);
+        }
+    }
+}
+
+static bool relay_forward(relay_car_t * car, const std::shared_ptr<ws_viewer_t> & v, const std::string & msg){
+    std::lock_guard<std::mutex> l(car->ws_send_lock);
+    if(car->ws_sock < 0){
+        car->ctrl_dropped++;
+        return false;
+    }
+    int stamp;
+    if(json_int(msg, "c", &stamp)){
+        std::lock_guard<std::mutex> q(car->lock);
+        if(car->echoes.size() >= RELAY_ECHO_MAX){
+            car->echoes.pop_front();
+            car->echo_lost++;
+        }
+        car->echoes.push_back({v, stamp, now_us()});
+    }
+    car->ctrl_fwd++;
+    return ws_send(car->ws_sock, WS_OP_TEXT, msg.data(), msg.size(), true);
+}
+
+static void relay_subscribe(relay_car_t * car, int * count, int64_t * idle_since, int delta){
+    std::lock_guard<std::mutex> l(car->lock);
+    *count += delta;
+    if(*count == 0){
+        *idle_since = now_us();
+    }
+    car->wake_cv.notify_all();
+}
+
+// Where a new viewer starts: the current frame if the stream is live, otherwise
+// the next one, so nobody is shown a picture left over from an earlier session
+static uint64_t relay_first_seq(relay_car_t * car){
+    std::lock_guard<std::mutex> l(car->lock);
+    return car->stream_up && car->frame_seq ? car->frame_seq - 1 : car->frame_seq;
+}
+
+// Takes the newest frame for a viewer that last got *seen; car->lock held
+static std::shared_ptr<const relay_frame_t> relay_take_frame(relay_car_t * car, uint64_t * seen){
+    car->frames_skipped += car->frame_seq - *seen - 1;
+    *seen = car->frame_seq;
+    return car->frame;
+}
+
+// Waits for a frame newer than *seen; NULL after a second without one so the
+// caller can check whether its viewer is still there.
+static std::shared_ptr<const relay_frame_t> relay_next_frame(relay_car_t * car, uint64_t * seen){
+    std::unique_lock<std::mutex> l(car->lock);
+    if(!car->frame_cv.wait_for(l, std::chrono::seconds(1), [car, seen](){ return car->frame_seq != *seen; })){
+        return NULL;
+    }
+    return relay_take_frame(car, seen);
+}
+
+// Like stream_tune_socket in the firmware: a small send buffer makes a slow
+// viewer block in send() and skip frames rather than queue seconds of video
+static void relay_tune_viewer(int sock){
+    int sndbuf = RELAY_SNDBUF_SIZE;
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+}
+
+static bool peer_closed(int sock){
+    struct pollfd pfd = {sock, POLLIN, 0};
+    char c;
+    return poll(&pfd, 1, 0) > 0 && recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT) <= 0;
+}
+
+static void relay_stream_viewer(relay_car_t * car, int sock){
+    relay_tune_viewer(sock);
+    if(!send_str(sock, std::string(STREAM_RESP_HEADER) + STREAM_BOUNDARY)){
+        return;
+    }
+    relay_subscribe(car, &car->video_viewers, &car->video_idle_since, 1);
+    uint64_t seen = relay_first_seq(car);
+    while(true){
+        std::shared_ptr<const relay_frame_t> f = relay_next_frame(car, &seen);
+        if(!f){
+            if(peer_closed(sock)){
+                break;
+            }
+            continue;
+        }
+        if(!send_part(sock, f->jpeg, f->stamp.empty() ? "0.000000" : f->stamp.c_str())){
+            break;
+        }
+        car->frames_out++;
+    }
+    relay_subscribe(car, &car->video_viewers, &car->video_idle_since, -1);
+}
+
+// The only thread writing to a ws viewer: queued echoes and pongs first, then
+// the newest frame if the viewer asked for video.
+static void relay_ws_writer(relay_car_t * car, std::shared_ptr<ws_viewer_t> v){
+    uint64_t seen = relay_first_seq(car);
+    while(true){
+        std::deque<ws_message_t> out;
+        std::shared_ptr<const relay_frame_t> f;
+        {
+            std::unique_lock<std::mutex> l(car->lock);
+            car->frame_cv.wait(l, [car, v, seen](){
+                return !v->alive || !v->outbox.empty() || (v->video && car->frame_seq != seen);
+            });
+            if(!v->alive){
+                break;
+            }
+            out.swap(v->outbox);
+            if(v->video && car->frame_seq != seen){
+                f = relay_take_frame(car, &seen);
+            }
+        }
+        bool ok = true;
+        for(const ws_message_t & m : out){
+            ok = ok && ws_send(v->sock, m.opcode, m.data.data(), m.data.size(), false);
+        }
+        if(ok && f){
+            ok = ws_send(v->sock, WS_OP_BINARY, f->jpeg.data(), f->jpeg.size(), false);
+            car->frames_out++;
+        }
+        if(!ok){
+            shutdown(v->sock, SHUT_RDWR);   //unblocks the reader
+            break;
+        }
+    }
+}
+
+static void relay_ws_queue(relay_car_t * car, const std::shared_ptr<ws_viewer_t> & v, int opcode, const std::string & data){
+    std::lock_guard<std::mutex> l(car->lock);
+    v->outbox.push_back({opcode, data});
+    car->frame_cv.notify_all();
+}
+
+static void relay_ws_viewer(relay_car_t * car, int sock, http_req_t * req){
+    if(!ws_server_handshake(sock, req)){
+        return;
+    }
+    auto v = std::make_shared<ws_viewer_t>();
+    v->sock = sock;
+    v->alive = true;
+    v->video = query_value(req->query, "video") == "1";
+    v->drove = false;
+
+    relay_subscribe(car, &car->ctrl_viewers, &car->ctrl_idle_since, 1);
+    {
+        // the first commands of a new driver wait in the socket until the upstream is there
+        std::unique_lock<std::mutex> l(car->lock);
+        car->wake_cv.wait_for(l, std::chrono::seconds(RELAY_TIMEOUT_S), [car](){ return car->ws_up; });
+    }
+    if(v->video){
+        relay_tune_viewer(sock);
+        relay_subscribe(car, &car->video_viewers, &car->video_idle_since, 1);
+    }
+    std::thread writer(relay_ws_writer, car, v);
+
+    std::string buf = req->rest;
+    int op;
+    std::string msg;
+    while(ws_read(sock, &buf, &op, &msg) && op != WS_OP_CLOSE){
+        if(op == WS_OP_PING){
+            relay_ws_queue(car, v, WS_OP_PONG, msg);
+        } else if(op == WS_OP_TEXT){
+            car->ctrl_in++;
+            v->drove = true;
+            relay_forward(car, v, msg);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> l(car->lock);
+        v->alive = false;
+        car->frame_cv.notify_all();
+    }
+    shutdown(sock, SHUT_RDWR);      //unblocks a writer stuck in send()
+    writer.join();
+    if(v->video){
+        relay_subscribe(car, &car->video_viewers, &car->video_idle_since, -1);
+    }
+    // the car keeps its last command while /ws stays open, so stop it for a driver that left
+    if(v->drove){
+        relay_forward(car, v, "{\"t\":0,\"s\":0}");
+    }
+    relay_subscribe(car, &car->ctrl_viewers, &car->ctrl_idle_since, -1);
+}
+
+// Polls every car's /stats so /metrics can show the fleet in one request
+static void relay_stats_task(int interval){
+    while(true){
+        for(relay_car_t * car : relay_cars){
+            std::string body;
+            int sock = tcp_connect(car->host.c_str(), car->base_port);
+            if(sock >= 0){
+                std::string req = "GET /stats HTTP/1.0\r\nHost: " + car->host + "\r\n\r\n";
+                std::string buf;
+                if(send_str(sock, req)){
+                    char tmp[2048];
+                    ssize_t n;
+                    while((n = recv(sock, tmp, sizeof(tmp), 0)) > 0){
+                        buf.append(tmp, n);
+                    }
+                }
+                close(sock);
+                size_t start = buf.find("\r\n\r\n");
+                if(start != std::string::npos && buf.compare(start + 4, 1, "{") == 0){
+                    body = buf.substr(start + 4);
+                    while(!body.empty() && body.back() != '}'){
+                        body.pop_back();
+                    }
+                }
+            }
+            std::lock_guard<std::mutex> l(car->lock);
+            if(body.empty()){
+                car->stats_errors++;
+            }
+            car->car_stats = body;
+        }
+        sleep(interval);
+    }
+}
+
+static std::string relay_metrics(){
+    char tmp[1024];
+    std::string out;
+    uint64_t frames_in = 0, frames_out = 0, skipped = 0;
+    int viewers = 0, up = 0;
+    snprintf(tmp, sizeof(tmp), "{\"uptime_s\":%lld,\"cars\":[", (long long)((now_us() - relay_start_us) / 1000000));
+    out += tmp;
+    for(size_t i = 0; i < relay_cars.size(); i++){
+        relay_car_t * car = relay_cars[i];
+        std::lock_guard<std::mutex> l(car->lock);
+        int64_t age = car->frame ? (now_us() - car->frame->arrival_us) / 1000 : -1;
+        snprintf(tmp, sizeof(tmp),
+            "%s{\"name\":\"%s\",\"host\":\"%s\",\"stream_up\":%d,\"ws_up\":%d,"
+            "\"stream_connects\":%u,\"ws_connects\":%u,\"video_viewers\":%d,\"ctrl_viewers\":%d,"
+            "\"fps\":%.1f,\"frame_age_ms\":%lld,\"frames_in\":%llu,\"bytes_in\":%llu,"
+            "\"frames_out\":%llu,\"frames_skipped\":%llu,"
+            "\"ctrl_in\":%llu,\"ctrl_fwd\":%llu,\"ctrl_dropped\":%llu,\"echo_lost\":%llu,\"ctrl_rtt_last\":%u,\"ctrl_rtt_max\":%u,"
+            "\"stats_errors\":%u,\"car\":",
+            i ? "," : "", car->name.c_str(), car->host.c_str(), car->stream_up, car->ws_up,
+            car->stream_connects, car->ws_connects, car->video_viewers, car->ctrl_viewers,
+            car->stream_up ? car->fps : 0.0, (long long)age,
+            (unsigned long long)car->frames_in, (unsigned long long)car->bytes_in,
+            (unsigned long long)car->frames_out, (unsigned long long)car->frames_skipped,
+            (unsigned long long)car->ctrl_in, (unsigned long long)car->ctrl_fwd,
+            (unsigned long long)car->ctrl_dropped, (unsigned long long)car->echo_lost, car->rtt_last_ms, car->rtt_max_ms, car->stats_errors);
+        out += tmp;
+        out += car->car_stats.empty() ? "null" : car->car_stats;
+        out += "}";
+        frames_in += car->frames_in;
+        frames_out += car->frames_out;
+        skipped += car->frames_skipped;
+        viewers += car->video_viewers + car->ctrl_viewers;
+        up += car->stream_up || car->ws_up || !car->car_stats.empty();
+    }
+    snprintf(tmp, sizeof(tmp), "],\"cars_reachable\":%d,\"viewers\":%d,\"frames_in\":%llu,\"frames_out\":%llu,\"frames_skipped\":%llu}\n",
+             up, viewers, (unsigned long long)frames_in, (unsigned long long)frames_out, (unsigned long long)skipped);
+    out += tmp;
+    return out;
+}
+
+static void relay_handler(int sock, http_req_t * req){
+    if(req->path == "/metrics"){
+        http_reply(sock, "200 OK", "application/json", relay_metrics());
+        return;
+    }
+    if(req->path == "/"){
+        std::string page = "<!DOCTYPE html><html><body>";
+        for(relay_car_t * car : relay_cars){
+            page += "<div><h3>" + car->name + "</h3><img src=\"/" + car->name + "/stream\" style=\"max-width:480px\"></div>";
+        }
+        page += "<p><a href=\"/metrics\">metrics</a></p></body></html>";
+        http_reply(sock, "200 OK", "text/html", page);
+        return;
+    }
+    size_t slash = req->path.find('/', 1);
+    relay_car_t * car = slash == std::string::npos ? NULL : relay_find(req->path.substr(1, slash - 1));
+    std::string what = slash == std::string::npos ? "" : req->path.substr(slash);
+    if(car && what == "/stream"){
+        relay_stream_viewer(car, sock);
+    } else if(car && what == "/ws"){
+        relay_ws_viewer(car, sock, req);
+    } else if(car && what == "/snapshot"){
+        std::shared_ptr<const relay_frame_t> f;
+        {
+            std::lock_guard<std::mutex> l(car->lock);
+            f = car->stream_up ? car->frame : NULL;
+        }
+        if(f){
+            http_reply(sock, "200 OK", "image/jpeg", f->jpeg);
+        } else {
+            http_reply(sock, "503 Service Unavailable", "text/plain", "no stream from the car, open /stream first\n");
+        }
+    } else {
+        http_reply(sock, "404 Not Found", "text/plain", "not found\n");
+    }
+}
+
+static int run_relay(int port, int stats_interval, const std::vector<std::string> & specs){
+    relay_start_us = now_us();
+    for(const std::string & spec : specs){
+        size_t eq = spec.find('=');
+        if(eq == std::string::npos || eq == 0){
+            fprintf(stderr, "bad car '%s', expected name=host[:base]\n", spec.c_str());
+            return 2;
+        }
+        relay_car_t * car = new relay_car_t();
+        car->name = spec.substr(0, eq);
+        car->host = spec.substr(eq + 1);
+        car->base_port = 80;
+        size_t colon = car->host.find(':');
+        if(colon != std::string::npos){
+            car->base_port = atoi(car->host.c_str() + colon + 1);
+            car->host.erase(colon);
+        }
+        car->ws_sock = -1;
+        if(relay_find(car->name)){
+            fprintf(stderr, "duplicate car name '%s'\n", car->name.c_str());
+            return 2;
+        }
+        relay_cars.push_back(car);
+        std::thread(relay_stream_task, car).detach();
+        std::thread(relay_ws_task, car).detach();
+        printf("car %s at %s (ports %d/%d/%d)\n", car->name.c_str(), car->host.c_str(),
+               car->base_port, car->base_port + 1, car->base_port + 2);
+    }
+    if(stats_interval > 0){
+        std::thread(relay_stats_task, stats_interval).detach();
+    }
+    http_serve(port, relay_handler);
+    printf("relay listening on port %d\n", port);
+    while(true){
+        pause();
+    }
+}
+
+/* ---------------- stand-in car ---------------- */
+
+static std::vector<std::string> standin_frames;
+static int standin_fps;
+static std::atomic<int> standin_stream_clients(0);
+static std::atomic<uint32_t> standin_stream_connects(0);
+static std::atomic<int> standin_ctrl_clients(0);
+static std::atomic<uint32_t> standin_ctrl_msgs(0);
+static std::atomic<uint32_t> standin_frames_sent(0);
+
+// Same response and part format as stream_handler in the firmware
+static void standin_stream(int sock, http_req_t * req){
+    if(req->path != "/stream"){
+        http_reply(sock, "404 Not Found", "text/plain", "not found\n");
+        return;
+    }
+    standin_stream_clients++;
+    standin_stream_connects++;
+    printf("standin: stream client connected (%d open)\n", (int)standin_stream_clients);
+    bool ok = send_str(sock, std::string(STREAM_RESP_HEADER) + STREAM_BOUNDARY);
+    for(uint32_t i = 0; ok; i++){
+        const std::string & f = standin_frames[i % standin_frames.size()];
+        int64_t t = now_us();
+        char stamp[32];
+        snprintf(stamp, sizeof(stamp), "%u.%06u", (unsigned)(t / 1000000), (unsigned)(t % 1000000));
+        ok = send_part(sock, f, stamp);
+        standin_frames_sent++;
+        usleep(1000000 / standin_fps);
+    }
+    standin_stream_clients--;
+    printf("standin: stream client left (%d open)\n", (int)standin_stream_clients);
+}
+
+// Echoes "c" like ctrl_track_latency and logs the drive command at most once a second
+static void standin_ws(int sock, http_req_t * req){
+    if(req->path != "/ws" || !ws_server_handshake(sock, req)){
+        return;
+    }
+    standin_ctrl_clients++;
+    printf("standin: control client connected (%d open)\n", (int)standin_ctrl_clients);
+    std::string buf = req->rest, msg;
+    int op;
+    int64_t last_log = 0;
+    while(ws_read(sock, &buf, &op, &msg) && op != WS_OP_CLOSE){
+        if(op == WS_OP_PING){
+            ws_send(sock, WS_OP_PONG, msg.data(), msg.size(), false);
+            continue;
+        }
+        if(op != WS_OP_TEXT){
+            continue;
+        }
+        standin_ctrl_msgs++;
+        int t = 0, s = 0, left, right;
+        sscanf(msg.c_str(), "{\"t\":%d,\"s\":%d", &t, &s);
+        drive_mix(t, s, &left, &right);
+        if(now_us() - last_log > 1000000 || (t == 0 && s == 0)){
+            last_log = now_us();
+            printf("standin: t %d s %d -> left %d right %d\n", t, s, left, right);
+        }
+        int stamp;
+        if(json_int(msg, "c", &stamp)){
+            char echo[32];
+            int len = snprintf(echo, sizeof(echo), "{\"c\":%d}", stamp);
+            ws_send(sock, WS_OP_TEXT, echo, len, false);
+        }
+    }
+    standin_ctrl_clients--;
+    printf("standin: control client left (%d open)\n", (int)standin_ctrl_clients);
+}
+
+static void standin_stats(int sock, http_req_t * req){
+    if(req->path != "/stats"){
+        http_reply(sock, "404 Not Found", "text/plain", "not found\n");
+        return;
+    }
+    char json[256];
+    snprintf(json, sizeof(json), "{\"standin\":1,\"stream_clients\":%d,\"stream_connects\":%u,"
+             "\"ctrl_clients\":%d,\"ctrl_msgs\":%u,\"video_frames\":%u}",
+             (int)standin_stream_clients, (unsigned)standin_stream_connects,
+             (int)standin_ctrl_clients, (unsigned)standin_ctrl_msgs, (unsigned)standin_frames_sent);
+    http_reply(sock, "200 OK", "application/json", json);
+}
+
+static int run_standin(int base_port, int fps, const std::vector<std::string> & files){
+    for(const std::string & name : files){
+        FILE * fp = fopen(name.c_str(), "rb");
+        if(!fp){
+            perror(name.c_str());
+            return 1;
+        }
+        std::string data;
+        char tmp[8192];
+        size_t n;
+        while((n = fread(tmp, 1, sizeof(tmp), fp)) > 0){
+            data.append(tmp, n);
+        }
+        fclose(fp);
+        standin_frames.push_back(data);
+    }
+    standin_fps = fps;
+    http_serve(base_port, standin_stats);
+    http_serve(base_port + 1, standin_stream);
+    http_serve(base_port + 2, standin_ws);
+    printf("standin car: /stats on %d, /stream on %d, /ws on %d, %zu frame(s) at %d fps\n",
+           base_port, base_port + 1, base_port + 2, standin_frames.size(), fps);
+    while(true){
+        pause();
+    }
+}
+
+static void usage(){
+    fprintf(stderr,
+        "usage: car_relay [-p port] [-s stats_seconds] name=host[:base]...\n"
+        "       car_relay standin [-P base] [-r fps] <file.jpg>...\n");
+    exit(2);
+}
+
+int main(int argc, char ** argv){
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    srand(now_us());
+
+    bool standin = argc > 1 && !strcmp(argv[1], "standin");
+    int port = 8080, base_port = 80, stats_interval = 5, fps = 15;
+    std::vector<std::string> args;
+    for(int i = standin ? 2 : 1; i < argc; i++){
+        const char * a = argv[i];
+        bool more = i + 1 < argc;
+        if(!strcmp(a, "-p") && more) port = atoi(argv[++i]);
+        else if(!strcmp(a, "-P") && more) base_port = atoi(argv[++i]);
+        else if(!strcmp(a, "-s") && more) stats_interval = atoi(argv[++i]);
+        else if(!strcmp(a, "-r") && more) fps = atoi(argv[++i]);
+        else if(a[0] != '-') args.push_back(a);
+        else usage();
+    }
+
+    if(args.empty()){
+        usage();
+    }
+    if(standin){
+        if(fps <= 0){
+            usage();
+        }
+        return run_standin(base_port, fps, args);
+    }
+    return run_relay(port, stats_interval, args);
+}
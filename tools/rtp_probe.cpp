@@ -0,0 +1,407 @@
+/*
+ * @Date: 2026-10-19 10:00:00
+ * @Description: ESP32 Camera Surveillance Car
+ *               Linux receiver comparing the RTP/JPEG stream with the MJPEG
+ *               stream: frame rate, loss and latency added on the way.
+ *
+ *   g++ -std=c++17 -O2 -Wall -o rtp_probe tools/rtp_probe.cpp
+ *
+ *   curl -s "http://<car>/rtp.sdp?port=5004" > car.sdp
+ *   ./rtp_probe rtp -p 5004 -d 30            # then stop with /control?var=rtp&val=0
+ *   ./rtp_probe mjpeg -d 30 <car>            # http://<car>:81/stream
+ *   ./rtp_probe send -p 5004 -r 20 127.0.0.1 a.jpg b.jpg   # sender stand-in
+ *
+ *   ffplay -protocol_whitelist file,udp,rtp -fflags nobuffer car.sdp
+ *   gst-launch-1.0 filesrc location=car.sdp ! sdpdemux latency=0 ! rtpjpegdepay ! jpegdec ! autovideosink
+ *
+ * The car stops sending after 30 s without RTCP receiver reports. The SDP's
+ * c= line is the car, so both players above send their reports to it on the
+ * RTP port + 1 by themselves, and so does rtp mode here. A bare udpsrc
+ * pipeline sends none and has to repeat the /rtp.sdp request instead.
+ *
+ * Sender and receiver clocks are not synchronised, so latency is reported as
+ * the delay above the smallest one seen in the run (queueing, retransmission,
+ * reassembly), which is what differs between the two transports.
+ * @FilePath:
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../car_proto.h"
+
+static int64_t now_us(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+typedef struct {
+        uint32_t frames;
+        uint32_t broken_frames;     //RTP frames missing fragments
+        uint32_t packets;
+        uint32_t lost_packets;
+        uint32_t reordered_packets;
+        uint64_t bytes;
+        int64_t max_gap_us;         //longest wait between two complete frames
+        int64_t last_frame_us;
+        int64_t min_delay_us;
+        std::vector<int64_t> delays; //arrival - send time, per frame
+} probe_stats_t;
+
+static void stats_frame(probe_stats_t * st, int64_t arrival_us, int64_t sender_us){
+    st->frames++;
+    if(st->last_frame_us && arrival_us - st->last_frame_us > st->max_gap_us){
+        st->max_gap_us = arrival_us - st->last_frame_us;
+    }
+    st->last_frame_us = arrival_us;
+    int64_t delay = arrival_us - sender_us;
+    if(st->delays.empty() || delay < st->min_delay_us){
+        st->min_delay_us = delay;
+    }
+    st->delays.push_back(delay);
+}
+
+static void stats_report(probe_stats_t * st, double seconds){
+    printf("frames %u (%.1f fps), %.1f kB/s, longest gap %.0f ms\n",
+           st->frames, st->frames / seconds, st->bytes / seconds / 1000.0, st->max_gap_us / 1000.0);
+    if(st->packets){
+        printf("packets %u, lost %u (%.2f%%), reordered %u, frames with missing fragments %u\n",
+               st->packets, st->lost_packets, 100.0 * st->lost_packets / (st->packets + st->lost_packets),
+               st->reordered_packets, st->broken_frames);
+    }
+    if(st->delays.empty()){
+        return;
+    }
+    std::vector<int64_t> extra;
+    for(int64_t d : st->delays){
+        extra.push_back(d - st->min_delay_us);
+    }
+    std::sort(extra.begin(), extra.end());
+    double sum = 0;
+    for(int64_t e : extra){
+        sum += e;
+    }
+    printf("delay above minimum: avg %.1f ms, p50 %.1f ms, p95 %.1f ms, max %.1f ms\n",
+           sum / extra.size() / 1000.0, extra[extra.size() / 2] / 1000.0,
+           extra[extra.size() * 95 / 100] / 1000.0, extra.back() / 1000.0);
+}
+
+static int udp_bind(int port){
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    int rcvbuf = 1 << 20;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if(sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+        perror("bind");
+        exit(1);
+    }
+    return sock;
+}
+
+static int run_rtp(int port, int duration){
+    int sock = udp_bind(port);
+    probe_stats_t st = {};
+    uint8_t pkt[2048];
+    bool have_seq = false, in_frame = false, frame_ok = false;
+    uint16_t next_seq = 0;
+    uint32_t frame_ts = 0, base_ts = 0;
+    uint32_t next_offset = 0;
+    int64_t base_sender_us = 0, start = 0, last_rr = 0;
+    uint32_t rr_ssrc = rand();
+
+    printf("waiting for RTP/JPEG on udp/%d\n", port);
+    while(!start || now_us() - start < (int64_t)duration * 1000000){
+        struct pollfd pfd = {sock, POLLIN, 0};
+        if(poll(&pfd, 1, 200) <= 0){
+            continue;
+        }
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(sock, pkt, sizeof(pkt), 0, (struct sockaddr *)&from, &from_len);
+        int64_t arrival = now_us();
+        if(len > 0 && arrival - last_rr > 5000000){
+            // keep the sender's lease: empty RR to it on our RTP port + 1, like a player reading c=
+            uint8_t rr[RTCP_RR_LEN];
+            from.sin_port = htons(port + 1);
+            sendto(sock, rr, rtcp_encode_rr(rr, rr_ssrc), 0, (struct sockaddr *)&from, sizeof(from));
+            last_rr = arrival;
+        }
+        if(len < RTP_HEADER_LEN + RTP_JPEG_HEADER_LEN || (pkt[0] >> 6) != 2 || (pkt[1] & 0x7F) != RTP_JPEG_PT){
+            continue;
+        }
+        if(!start){
+            start = arrival;
+        }
+        uint16_t seq = proto_get_be16(pkt + 2);
+        uint32_t ts = proto_get_be32(pkt + 4);
+        bool marker = pkt[1] & 0x80;
+        uint32_t offset = proto_get_be32(pkt + RTP_HEADER_LEN) & 0xFFFFFF;
+        uint8_t type = pkt[RTP_HEADER_LEN + 4];
+        uint8_t q = pkt[RTP_HEADER_LEN + 5];
+
+        st.packets++;
+        st.bytes += len;
+        if(have_seq){
+            int16_t d = (int16_t)(seq - next_seq);
+            if(d < 0){
+                st.reordered_packets++;
+                continue;           //late fragment of a frame already judged
+            }
+            st.lost_packets += d;
+        }
+        have_seq = true;
+        next_seq = seq + 1;
+
+        if(!in_frame || ts != frame_ts){
+            if(in_frame){
+                st.broken_frames++; //previous frame never saw its marker
+            }
+            in_frame = true;
+            frame_ok = true;
+            frame_ts = ts;
+            next_offset = 0;
+        }
+        size_t payload = len - RTP_HEADER_LEN - RTP_JPEG_HEADER_LEN;
+        if(type >= 64){
+            payload -= 4;
+        }
+        if(offset == 0 && q >= 128){
+            size_t qhdr = RTP_HEADER_LEN + RTP_JPEG_HEADER_LEN + (type >= 64 ? 4 : 0);
+            payload -= 4 + proto_get_be16(pkt + qhdr + 2);
+        }
+        if(offset != next_offset){
+            frame_ok = false;
+        }
+        next_offset = offset + payload;
+
+        if(marker){
+            in_frame = false;
+            if(!frame_ok){
+                st.broken_frames++;
+                continue;
+            }
+            if(!base_sender_us){
+                base_ts = ts;
+                base_sender_us = 1;
+            }
+            // unwrapped 90 kHz sender clock relative to the first frame
+            int64_t sender_us = (int64_t)(uint32_t)(ts - base_ts) * 1000000 / RTP_JPEG_CLOCK;
+            stats_frame(&st, arrival, sender_us);
+        }
+    }
+    stats_report(&st, (now_us() - start) / 1e6);
+    return 0;
+}
+
+static bool read_line(int sock, std::string * buf, std::string * line){
+    while(true){
+        size_t nl = buf->find("\r\n");
+        if(nl != std::string::npos){
+            *line = buf->substr(0, nl);
+            buf->erase(0, nl + 2);
+            return true;
+        }
+        char tmp[4096];
+        ssize_t n = recv(sock, tmp, sizeof(tmp), 0);
+        if(n <= 0){
+            return false;
+        }
+        buf->append(tmp, n);
+    }
+}
+
+static bool read_bytes(int sock, std::string * buf, size_t len){
+    while(buf->size() < len){
+        char tmp[16384];
+        ssize_t n = recv(sock, tmp, sizeof(tmp), 0);
+        if(n <= 0){
+            return false;
+        }
+        buf->append(tmp, n);
+    }
+    return true;
+}
+
+static int tcp_connect(const char * host, int port){
+    struct addrinfo hints, * res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    if(getaddrinfo(host, port_str, &hints, &res) != 0){
+        fprintf(stderr, "cannot resolve %s\n", host);
+        exit(1);
+    }
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if(sock < 0 || connect(sock, res->ai_addr, res->ai_addrlen) < 0){
+        perror("connect");
+        exit(1);
+    }
+    freeaddrinfo(res);
+    return sock;
+}
+
+static int run_mjpeg(const char * host, int port, const char * path, int duration){
+    int sock = tcp_connect(host, port);
+    std::string req = std::string("GET ") + path + " HTTP/1.1\r\nHost: " + host + "\r\n\r\n";
+    send(sock, req.data(), req.size(), 0);
+
+    std::string buf, line;
+    if(!read_line(sock, &buf, &line) || line.find(" 200") == std::string::npos){
+        fprintf(stderr, "bad response: %s\n", line.c_str());
+        return 1;
+    }
+    while(read_line(sock, &buf, &line) && !line.empty()){
+    }
+
+    probe_stats_t st = {};
+    int64_t start = now_us();
+    int64_t base_sender_us = -1;
+    while(now_us() - start < (int64_t)duration * 1000000){
+        size_t content_len = 0;
+        int64_t sender_us = -1;
+        bool in_part = false;
+        while(read_line(sock, &buf, &line)){
+            if(line.empty()){
+                if(in_part){
+                    break;              //end of part header
+                }
+                continue;
+            }
+            if(line.compare(0, 2, "--") == 0){
+                in_part = true;
+            } else if(strncasecmp(line.c_str(), "Content-Length:", 15) == 0){
+                content_len = strtoul(line.c_str() + 15, NULL, 10);
+            } else if(strncasecmp(line.c_str(), "X-Timestamp:", 12) == 0){
+                sender_us = (int64_t)(strtod(line.c_str() + 12, NULL) * 1e6);
+            }
+        }
+        if(!content_len || !read_bytes(sock, &buf, content_len)){
+            break;
+        }
+        buf.erase(0, content_len);
+        int64_t arrival = now_us();
+        st.bytes += content_len;
+        if(sender_us < 0){
+            stats_frame(&st, arrival, arrival);   //firmware without X-Timestamp
+            continue;
+        }
+        if(base_sender_us < 0){
+            base_sender_us = sender_us;
+        }
+        stats_frame(&st, arrival, sender_us - base_sender_us);
+    }
+    close(sock);
+    stats_report(&st, (now_us() - start) / 1e6);
+    return 0;
+}
+
+static int run_send(const char * host, int port, int fps, std::vector<std::string> files){
+    std::vector<std::string> frames;
+    for(const std::string & f : files){
+        FILE * fp = fopen(f.c_str(), "rb");
+        if(!fp){
+            perror(f.c_str());
+            return 1;
+        }
+        std::string data;
+        char tmp[8192];
+        size_t n;
+        while((n = fread(tmp, 1, sizeof(tmp), fp)) > 0){
+            data.append(tmp, n);
+        }
+        fclose(fp);
+        rtp_jpeg_t j;
+        if(!rtp_jpeg_parse((const uint8_t *)data.data(), data.size(), &j)){
+            fprintf(stderr, "%s: not a baseline 4:2:x JPEG with two quantization tables\n", f.c_str());
+            return 1;
+        }
+        frames.push_back(data);
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct addrinfo hints, * res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    if(getaddrinfo(host, port_str, &hints, &res) != 0 || connect(sock, res->ai_addr, res->ai_addrlen) < 0){
+        fprintf(stderr, "cannot reach %s\n", host);
+        return 1;
+    }
+    freeaddrinfo(res);
+
+    uint16_t seq = rand();
+    uint32_t ssrc = rand();
+    uint8_t pkt[RTP_JPEG_MTU];
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("sending %zu frame(s) in a loop to %s:%d at %d fps\n", frames.size(), host, port, fps);
+    for(uint32_t i = 0; ; i++){
+        const std::string & data = frames[i % frames.size()];
+        rtp_jpeg_t j;
+        rtp_jpeg_parse((const uint8_t *)data.data(), data.size(), &j);
+        uint32_t ts = (uint32_t)(now_us() * (RTP_JPEG_CLOCK / 1000) / 1000);
+        size_t offset = 0, len;
+        while((len = rtp_jpeg_packet(&j, &offset, seq, ts, ssrc, pkt, sizeof(pkt))) > 0){
+            send(sock, pkt, len, 0);
+            seq++;
+        }
+        usleep(1000000 / fps);
+    }
+}
+
+static void usage(){
+    fprintf(stderr,
+        "usage: rtp_probe rtp [-p port] [-d seconds]\n"
+        "       rtp_probe mjpeg [-P port] [--path /stream] [-d seconds] <host>\n"
+        "       rtp_probe send [-p port] [-r fps] <host> <file.jpg>...\n");
+    exit(2);
+}
+
+int main(int argc, char ** argv){
+    if(argc < 2){
+        usage();
+    }
+    std::string mode = argv[1];
+    int port = RTP_JPEG_DEFAULT_PORT, http_port = 81, duration = 10, fps = 20;
+    const char * path = "/stream";
+    std::vector<std::string> args;
+    for(int i = 2; i < argc; i++){
+        const char * a = argv[i];
+        bool more = i + 1 < argc;
+        if(!strcmp(a, "-p") && more) port = atoi(argv[++i]);
+        else if(!strcmp(a, "-P") && more) http_port = atoi(argv[++i]);
+        else if(!strcmp(a, "-d") && more) duration = atoi(argv[++i]);
+        else if(!strcmp(a, "-r") && more) fps = atoi(argv[++i]);
+        else if(!strcmp(a, "--path") && more) path = argv[++i];
+        else if(a[0] != '-') args.push_back(a);
+        else usage();
+    }
+
+    if(mode == "rtp" && args.empty()){
+        return run_rtp(port, duration);
+    }
+    if(mode == "mjpeg" && args.size() == 1){
+        return run_mjpeg(args[0].c_str(), http_port, path, duration);
+    }
+    if(mode == "send" && args.size() >= 2 && fps > 0){
+        return run_send(args[0].c_str(), port, fps, std::vector<std::string>(args.begin() + 1, args.end()));
+    }
+    usage();
+}
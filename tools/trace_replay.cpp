@@ -0,0 +1,239 @@
+/*
+ * @Date: 2026-10-19 10:00:00
+ * @Description: ESP32 Camera Surveillance Car
+ *               Replays a control trace downloaded from /trace, either through
+ *               the host build of the control path (drive_mix in car_proto.h)
+ *               or against a car over the UDP control port, and compares the
+ *               motor outputs with the recorded ones.
+ *
+ *   g++ -std=c++17 -O2 -Wall -o trace_replay tools/trace_replay.cpp
+ *
+ *   curl -s -o run.trace "http://<car>/trace"
+ *   ./trace_replay dump run.trace
+ *   ./trace_replay local --speed 0 run.trace        # as fast as possible
+ *   ./trace_replay udp --speed 2 <car> run.trace     # twice the original pace
+ *   ./trace_replay udp -p 9999 127.0.0.1 run.trace   # against udp_drive --car
+ * @FilePath:
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <algorithm>
+#include <vector>
+#include "../car_proto.h"
+
+static const char * source_names[] = {"ws", "udp", "http", "timeout"};
+
+static int64_t now_us(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool load_trace(const char * path, std::vector<trace_entry_t> * out, uint32_t * lost){
+    FILE * fp = fopen(path, "rb");
+    if(!fp){
+        perror(path);
+        return false;
+    }
+    uint8_t buf[TRACE_HEADER_LEN];
+    uint32_t count = 0;
+    if(fread(buf, 1, sizeof(buf), fp) != sizeof(buf) || !trace_decode_header(buf, &count, lost)){
+        fprintf(stderr, "%s: not a control trace\n", path);
+        fclose(fp);
+        return false;
+    }
+    for(uint32_t i = 0; i < count; i++){
+        uint8_t e[TRACE_ENTRY_LEN];
+        if(fread(e, 1, sizeof(e), fp) != sizeof(e)){
+            fprintf(stderr, "%s: truncated after %u of %u entries\n", path, i, count);
+            break;
+        }
+        trace_entry_t entry;
+        trace_decode_entry(e, &entry);
+        out->push_back(entry);
+    }
+    fclose(fp);
+    return true;
+}
+
+static const char * source_name(uint8_t source){
+    return source < sizeof(source_names) / sizeof(source_names[0]) ? source_names[source] : "?";
+}
+
+// Sleeps until entry i is due: the recorded gap to entry i-1 divided by speed
+static void pace(const std::vector<trace_entry_t> & trace, size_t i, double speed, int64_t * due){
+    if(i == 0){
+        *due = now_us();
+        return;
+    }
+    if(speed <= 0){
+        return;
+    }
+    *due += (int64_t)((uint32_t)(trace[i].time_us - trace[i - 1].time_us) / speed);
+    int64_t wait = *due - now_us();
+    if(wait > 0){
+        usleep(wait);
+    }
+}
+
+static int run_dump(const std::vector<trace_entry_t> & trace, uint32_t lost){
+    printf("%zu entries, %u lost on the car\n", trace.size(), lost);
+    printf("%10s %10s %-8s %6s %6s %5s %5s\n", "ms", "seq", "source", "thr", "steer", "L", "R");
+    for(size_t i = 0; i < trace.size(); i++){
+        const trace_entry_t & e = trace[i];
+        double ms = (uint32_t)(e.time_us - trace[0].time_us) / 1000.0;
+        printf("%10.1f %10u %-8s %6d %6d %5d %5d\n", ms, e.seq, source_name(e.source),
+               e.throttle, e.steer, e.left, e.right);
+    }
+
+    // arrival jitter of the stream of commands, what the driver felt as lag
+    std::vector<uint32_t> gaps;
+    for(size_t i = 1; i < trace.size(); i++){
+        gaps.push_back(trace[i].time_us - trace[i - 1].time_us);
+    }
+    if(!gaps.empty()){
+        std::sort(gaps.begin(), gaps.end());
+        printf("gap between commands: p50 %.1f ms, p95 %.1f ms, max %.1f ms\n",
+               gaps[gaps.size() / 2] / 1000.0, gaps[gaps.size() * 95 / 100] / 1000.0, gaps.back() / 1000.0);
+    }
+    return 0;
+}
+
+static void report_diff(size_t i, const trace_entry_t & e, int left, int right, uint32_t * diffs){
+    if(left == e.left && right == e.right){
+        return;
+    }
+    if(++*diffs <= 10){
+        printf("#%zu seq %u %s t=%d s=%d: recorded L=%d R=%d, replay L=%d R=%d\n", i, e.seq,
+               source_name(e.source), e.throttle, e.steer, e.left, e.right, left, right);
+    }
+}
+
+static int run_local(const std::vector<trace_entry_t> & trace, double speed){
+    uint32_t diffs = 0;
+    int64_t due = 0, start = now_us();
+    for(size_t i = 0; i < trace.size(); i++){
+        pace(trace, i, speed, &due);
+        const trace_entry_t & e = trace[i];
+        int left, right;
+        drive_mix(e.throttle, e.steer, &left, &right);
+        report_diff(i, e, left, right, &diffs);
+    }
+    printf("%zu commands replayed through drive_mix in %.2f s, %u outputs differ from the recording\n",
+           trace.size(), (now_us() - start) / 1e6, diffs);
+    return diffs ? 1 : 0;
+}
+
+static int run_udp(const std::vector<trace_entry_t> & trace, double speed, const char * host, int port){
+    struct addrinfo hints, * res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(getaddrinfo(host, port_str, &hints, &res) != 0 || connect(sock, res->ai_addr, res->ai_addrlen) < 0){
+        fprintf(stderr, "cannot reach %s\n", host);
+        return 1;
+    }
+    freeaddrinfo(res);
+
+    uint32_t diffs = 0, sent = 0, acked = 0;
+    std::vector<uint32_t> rtts;
+    int64_t due = 0, start = now_us();
+    uint32_t seq = 0;
+    for(size_t i = 0; i < trace.size(); i++){
+        pace(trace, i, speed, &due);
+        const trace_entry_t & e = trace[i];
+        if(e.source == TRACE_SRC_TIMEOUT){
+            continue;               //the car's own timeout reproduces these
+        }
+        // same i16 range as the trace, so the car sees exactly the recorded input
+        udp_ctrl_cmd_t cmd = {++seq, (uint32_t)(now_us() / 1000), e.throttle, e.steer};
+        uint8_t pkt[UDP_CTRL_CMD_LEN];
+        udp_ctrl_encode_cmd(pkt, &cmd);
+        send(sock, pkt, sizeof(pkt), 0);
+        sent++;
+
+        // the ack for this command, or give up on it after 100ms
+        int64_t deadline = now_us() + 100000;
+        int64_t left_us;
+        while((left_us = deadline - now_us()) > 0){
+            struct pollfd pfd = {sock, POLLIN, 0};
+            if(poll(&pfd, 1, (int)(left_us / 1000) + 1) <= 0){
+                break;
+            }
+            uint8_t buf[64];
+            ssize_t len = recv(sock, buf, sizeof(buf), 0);
+            udp_ctrl_ack_t ack;
+            if(len < 0 || !udp_ctrl_decode_ack(buf, len, &ack) || ack.seq != seq){
+                continue;
+            }
+            acked++;
+            rtts.push_back((uint32_t)(now_us() / 1000) - ack.stamp);
+            report_diff(i, e, ack.left, ack.right, &diffs);
+            break;
+        }
+    }
+
+    printf("%u commands sent in %.2f s, %u acked, %u outputs differ from the recording\n",
+           sent, (now_us() - start) / 1e6, acked, diffs);
+    if(!rtts.empty()){
+        std::sort(rtts.begin(), rtts.end());
+        printf("rtt p50 %u ms, p95 %u ms, max %u ms\n",
+               rtts[rtts.size() / 2], rtts[rtts.size() * 95 / 100], rtts.back());
+    }
+    return diffs || acked < sent ? 1 : 0;
+}
+
+static void usage(){
+    fprintf(stderr,
+        "usage: trace_replay dump <trace>\n"
+        "       trace_replay local [--speed x] <trace>\n"
+        "       trace_replay udp [--speed x] [-p port] <host> <trace>\n"
+        "       --speed 1 keeps the recorded timing, 2 doubles the pace, 0 sends back to back\n");
+    exit(2);
+}
+
+int main(int argc, char ** argv){
+    if(argc < 3){
+        usage();
+    }
+    const char * mode = argv[1];
+    double speed = 1.0;
+    int port = UDP_CTRL_PORT;
+    std::vector<const char *> args;
+    for(int i = 2; i < argc; i++){
+        bool more = i + 1 < argc;
+        if(!strcmp(argv[i], "--speed") && more) speed = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-p") && more) port = atoi(argv[++i]);
+        else if(argv[i][0] != '-') args.push_back(argv[i]);
+        else usage();
+    }
+
+    std::vector<trace_entry_t> trace;
+    uint32_t lost = 0;
+    if(args.empty()){
+        usage();
+    }
+    if(!load_trace(args.back(), &trace, &lost)){
+        return 1;
+    }
+    if(!strcmp(mode, "dump") && args.size() == 1){
+        return run_dump(trace, lost);
+    }
+    if(!strcmp(mode, "local") && args.size() == 1){
+        return run_local(trace, speed);
+    }
+    if(!strcmp(mode, "udp") && args.size() == 2){
+        return run_udp(trace, speed, args[0], port);
+    }
+    usage();
+}
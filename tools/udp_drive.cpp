@@ -0,0 +1,215 @@
+/*
+ * @Date: 2026-10-19 10:00:00
+ * @Description: ESP32 Camera Surveillance Car
+ *               Linux client for the UDP control port, plus a stand-in for the
+ *               car side so both ends can be exercised on localhost.
+ *
+ *   g++ -std=c++17 -O2 -Wall -o udp_drive tools/udp_drive.cpp
+ *
+ *   ./udp_drive --car                          # fake car on 127.0.0.1:8282
+ *   ./udp_drive -t 60 -s 10 -n 200 127.0.0.1   # drive it
+ *   ./udp_drive --reorder --dup --drop 20 127.0.0.1
+ * @FilePath:
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../car_proto.h"
+
+static uint32_t now_ms(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static int run_car(int port){
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if(sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0){
+        perror("bind");
+        return 1;
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("fake car listening on udp/%d\n", port);
+
+    // same drain-and-apply-newest loop as app_udpctrl.cpp, minus the PWM
+    udp_ctrl_state_t st;
+    memset(&st, 0, sizeof(st));
+    int left = 0, right = 0;
+    uint8_t buf[64];
+    while(true){
+        struct pollfd pfd = {sock, POLLIN, 0};
+        if(poll(&pfd, 1, 100) <= 0){
+            if(udp_ctrl_expired(&st, now_ms())){
+                left = right = 0;
+                printf("timeout: motors stopped\n");
+            }
+            continue;
+        }
+        udp_ctrl_batch_t batch = {};
+        struct sockaddr_in from, newest_from;
+        socklen_t from_len, newest_len = 0;
+        int queued = 0;
+        uint32_t discarded = st.discarded;
+        while(true){
+            from_len = sizeof(from);
+            ssize_t len = recvfrom(sock, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&from, &from_len);
+            if(len < 0){
+                break;
+            }
+            queued++;
+            if(udp_ctrl_batch_add(&batch, &st, buf, len, now_ms())){
+                newest_from = from;
+                newest_len = from_len;
+            }
+        }
+        if(st.discarded != discarded){
+            printf("%u stale/duplicate datagram(s) discarded\n", st.discarded - discarded);
+        }
+        if(!batch.have){
+            continue;
+        }
+        udp_ctrl_cmd_t cmd = batch.cmd;
+        drive_mix(cmd.throttle, cmd.steer, &left, &right);
+        printf("seq %u applied (newest of %d queued) t=%d s=%d -> L=%d R=%d\n",
+               cmd.seq, queued, cmd.throttle, cmd.steer, left, right);
+
+        udp_ctrl_ack_t ack = {cmd.seq, cmd.stamp, (int8_t)left, (int8_t)right, (uint16_t)st.discarded};
+        size_t n = udp_ctrl_encode_ack(buf, &ack);
+        sendto(sock, buf, n, 0, (struct sockaddr *)&newest_from, newest_len);
+    }
+}
+
+// Collects acks until deadline_ms, which also paces the commands
+static void drain_acks(int sock, uint32_t deadline_ms, uint32_t * acks, uint32_t * rtt_sum,
+                       uint32_t * rtt_max, udp_ctrl_ack_t * last){
+    uint8_t buf[64];
+    struct pollfd pfd = {sock, POLLIN, 0};
+    int32_t wait_ms;
+    while((wait_ms = (int32_t)(deadline_ms - now_ms())) > 0){
+        if(poll(&pfd, 1, wait_ms) <= 0){
+            continue;
+        }
+        ssize_t len = recv(sock, buf, sizeof(buf), 0);
+        udp_ctrl_ack_t ack;
+        if(len < 0 || !udp_ctrl_decode_ack(buf, len, &ack)){
+            continue;
+        }
+        uint32_t rtt = now_ms() - ack.stamp;
+        (*acks)++;
+        *rtt_sum += rtt;
+        if(rtt > *rtt_max){
+            *rtt_max = rtt;
+        }
+        *last = ack;
+    }
+}
+
+static void usage(){
+    fprintf(stderr,
+        "usage: udp_drive [-p port] [-r hz] [-n count] [-t throttle] [-s steer]\n"
+        "                 [--dup] [--reorder] [--drop pct] <host>\n"
+        "       udp_drive --car [-p port]\n");
+    exit(2);
+}
+
+int main(int argc, char ** argv){
+    int port = UDP_CTRL_PORT, rate = 20, count = 100, throttle = 0, steer = 0, drop = 0;
+    bool car = false, dup = false, reorder = false;
+    const char * host = NULL;
+
+    for(int i = 1; i < argc; i++){
+        const char * a = argv[i];
+        bool more = i + 1 < argc;
+        if(!strcmp(a, "--car")) car = true;
+        else if(!strcmp(a, "--dup")) dup = true;
+        else if(!strcmp(a, "--reorder")) reorder = true;
+        else if(!strcmp(a, "--drop") && more) drop = atoi(argv[++i]);
+        else if(!strcmp(a, "-p") && more) port = atoi(argv[++i]);
+        else if(!strcmp(a, "-r") && more) rate = atoi(argv[++i]);
+        else if(!strcmp(a, "-n") && more) count = atoi(argv[++i]);
+        else if(!strcmp(a, "-t") && more) throttle = atoi(argv[++i]);
+        else if(!strcmp(a, "-s") && more) steer = atoi(argv[++i]);
+        else if(a[0] != '-' && !host) host = a;
+        else usage();
+    }
+    if(car){
+        return run_car(port);
+    }
+    if(!host || rate <= 0){
+        usage();
+    }
+
+    struct addrinfo hints, * res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    char port_str[8];
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    if(getaddrinfo(host, port_str, &hints, &res) != 0){
+        fprintf(stderr, "cannot resolve %s\n", host);
+        return 1;
+    }
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if(sock < 0 || connect(sock, res->ai_addr, res->ai_addrlen) < 0){
+        perror("connect");
+        return 1;
+    }
+    freeaddrinfo(res);
+    srand(time(NULL));
+
+    uint32_t sent = 0, acks = 0, rtt_sum = 0, rtt_max = 0;
+    udp_ctrl_ack_t last;
+    memset(&last, 0, sizeof(last));
+    uint8_t held[UDP_CTRL_CMD_LEN];
+    bool holding = false;
+    uint32_t start = now_ms();
+
+    for(int seq = 1; seq <= count; seq++){
+        // ramp the stick to zero over the last quarter so the car ends stopped
+        int scale = seq > count * 3 / 4 ? (count - seq) * 100 / (count / 4 + 1) : 100;
+        udp_ctrl_cmd_t cmd = {(uint32_t)seq, now_ms(), (int16_t)(throttle * scale / 100), (int16_t)(steer * scale / 100)};
+        uint8_t pkt[UDP_CTRL_CMD_LEN];
+        udp_ctrl_encode_cmd(pkt, &cmd);
+
+        if(drop > 0 && rand() % 100 < drop){
+            // lost on the way
+        } else if(reorder && !holding && seq < count){
+            memcpy(held, pkt, sizeof(pkt));
+            holding = true;
+        } else {
+            send(sock, pkt, sizeof(pkt), 0);
+            sent++;
+            if(holding){
+                send(sock, held, sizeof(held), 0);  //arrives after its successor
+                sent++;
+                holding = false;
+            }
+            if(dup){
+                send(sock, pkt, sizeof(pkt), 0);
+                sent++;
+            }
+        }
+        drain_acks(sock, start + (uint32_t)((uint64_t)seq * 1000 / rate), &acks, &rtt_sum, &rtt_max, &last);
+    }
+    drain_acks(sock, now_ms() + 200, &acks, &rtt_sum, &rtt_max, &last);
+
+    printf("sent %u datagrams for %d commands, %u acks\n", sent, count, acks);
+    if(acks){
+        printf("rtt avg %ums max %ums\n", rtt_sum / acks, rtt_max);
+        printf("car: newest seq %u, motors L=%d R=%d, discarded %u\n",
+               last.seq, last.left, last.right, last.discarded);
+    }
+    return acks ? 0 : 1;
+}